@@ -39,6 +39,17 @@
   #include <malloc.h>
 #endif
 #include <locale.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* stop after this many samples, 0 for no limit (1.4 stopped after 95020) */
+#ifndef MAX_TEXT_VALUES
+#define MAX_TEXT_VALUES  0
+#endif
+
+#define CHUNK_FREE       0
+#define CHUNK_READ       1
+#define CHUNK_FORMATTED  2
 
 void utf8_to_latin1(char *);
 
@@ -55,6 +66,54 @@ struct edfparamblock{
          double sense;
        } *edfparam;
 
+/* datarecords on their way from the input file to text in the output file */
+struct textchunk{
+         char *in;                /* the datarecords as read */
+         char *out;               /* their text */
+         long long out_len;
+         long long out_size;
+         int records;
+         long long first_value;   /* number of the first sample in the output */
+         int state;               /* CHUNK_FREE, CHUNK_READ or CHUNK_FORMATTED */
+       };
+
+/* The main thread reads chunks of datarecords and handles their annotations, */
+/* formatting threads turn them into text and a writer thread writes them out */
+/* in order. The text of every datarecord follows one plan, made once: the    */
+/* samples, commas and newlines the per-row loop of version 1.4 printed.      */
+struct textconv{
+         pthread_mutex_t lock;
+         pthread_cond_t cond;
+         pthread_t *threads;
+         int nthreads;
+         struct textchunk *chunks;
+         int nchunks;
+         long long n_read,        /* chunks handed out by the main thread */
+                   n_formatted,   /* chunks taken by a formatting thread */
+                   n_written;     /* chunks written out */
+         int done,
+             failed;              /* 1 on a write error, 2 when out of memory */
+         FILE *outputfile;
+         int recordbytes;
+         int bdf;
+         int *plan_sig,           /* the signal of a sample, -1 for a comma, -2 for a newline */
+             *plan_smp;           /* the position of a sample in the datarecord */
+         int plan_len;
+         int values_per_record;
+         long long max_values;
+       };
+
+int build_text_plan(struct textconv *, int, int *, int);
+int start_text_threads(struct textconv *, int, int);
+struct textchunk *next_text_chunk(struct textconv *);
+void queue_text_chunk(struct textconv *, struct textchunk *, int, long long);
+int stop_text_threads(struct textconv *, struct textchunk *, int, long long);
+void *format_text_thread(void *);
+void *write_text_thread(void *);
+int format_text_chunk(struct textconv *, struct textchunk *);
+int format_fixed(char *, double);
+int format_int(char *, long long);
+
 
 
 int main(int argc, char *argv[])
@@ -71,8 +130,12 @@ int main(int argc, char *argv[])
       signals,
       datarecords,
       datarecordswritten,
+      records_to_read,
+      chunk_first,
+      chunk_end,
+      chunk_records,
+      threads,
       recordsize,
-      recordfull,
       edf=0,
       bdf=0,
       edfplus=0,
@@ -92,22 +155,16 @@ int main(int argc, char *argv[])
        *edf_hdr,
        *scratchpad,
        *cnv_buf,
+       *record=NULL,
        *time_in_txt,
        *duration_in_txt;
 
   double data_record_duration,
-         elapsedtime,
-         time_tmp,
-         d_tmp,
-         value_tmp=0.0;
+         elapsedtime;
+
+  struct textconv conv;
 
-  union {
-          unsigned int one;
-          signed int one_signed;
-          unsigned short two[2];
-          signed short two_signed[2];
-          unsigned char four[4];
-        } var;
+  struct textchunk *chunk=NULL;
 
 
 
@@ -529,7 +586,6 @@ int main(int argc, char *argv[])
   }
 
   fprintf(annotationfile, "Onset,Annotation\n");
- int zq = 0;
 /***************** write data ******************************/
 
   ascii_path[pathlen-4] = 0;
@@ -590,16 +646,89 @@ int main(int argc, char *argv[])
 
 /***************** start data conversion ******************************/
 
+  memset(&conv, 0, sizeof(conv));
+  conv.outputfile = outputfile;
+  conv.recordbytes = recordsize * samplesize;
+  conv.bdf = bdf;
+  conv.max_values = MAX_TEXT_VALUES;
+
+  if (build_text_plan(&conv, signals, annot_ch, (edfplus || bdfplus) ? nr_annot_chns : 0))
+  {
+    printf("Error, the samples of the signals can not be put in rows\n");
+    fclose(inputfile);
+    fclose(annotationfile);
+    fclose(outputfile);
+    free(edf_hdr);
+    free(edfparam);
+    free(cnv_buf);
+    free(time_in_txt);
+    free(duration_in_txt);
+    free(scratchpad);
+    return(1);
+  }
+
+  /* the datarecords up to the last sample that is written */
+  records_to_read = datarecords;
+  if ((conv.max_values > 0) && (conv.values_per_record > 0) && ((conv.max_values - 1) / conv.values_per_record + 1 < records_to_read))
+      records_to_read = (conv.max_values - 1) / conv.values_per_record + 1;
+
+  threads = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+  threads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if (threads < 1)
+      threads = 1;
+  if (threads > 64)
+      threads = 64;
+
+  chunk_records = 65536 / (conv.values_per_record + 1);
+  if (chunk_records < 1)
+      chunk_records = 1;
+
+  if (start_text_threads(&conv, threads, chunk_records))
+  {
+    printf("Malloc error! (text buffers)\n");
+    fclose(inputfile);
+    fclose(annotationfile);
+    fclose(outputfile);
+    free(edf_hdr);
+    free(edfparam);
+    free(cnv_buf);
+    free(time_in_txt);
+    free(duration_in_txt);
+    free(scratchpad);
+    return(1);
+  }
+
   datarecordswritten = 0;
+  chunk_first = 0;
+  chunk_end = 0;
 
-  for (i=0; i<datarecords; i++)
+  for (i=0; i<records_to_read; i++)
   {
-    for (j=0; j<signals; j++)
-        edfparam[j].smp_written = 0; //обнуляем колличество сигналов в записи
+    datarecordswritten = i;
+
+    if (i == chunk_end)
+    {
+      if (chunk != NULL)
+          queue_text_chunk(&conv, chunk, i - chunk_first, (long long)chunk_first * conv.values_per_record);
+
+      chunk = next_text_chunk(&conv);
+      chunk_first = i;
+      chunk_end = i;
+      if (chunk != NULL)
+          chunk_end += fread(chunk->in, conv.recordbytes, (records_to_read - i < chunk_records) ? records_to_read - i : chunk_records, inputfile);
+    }
 
-    if (fread(cnv_buf, recordsize * samplesize, 1, inputfile)!=1)
+    if (i == chunk_end)
     {
-      printf("Error when reading inputfile during conversion\n");
+      k = stop_text_threads(&conv, NULL, 0, 0);
+      if (k == 2)
+          printf("Malloc error! (text buffers)\n");
+      else if (k)
+          printf("Error when writing to outputfile during conversion\n");
+      else
+          printf("Error when reading inputfile during conversion\n");
       fclose(inputfile);
       fclose(annotationfile);
       fclose(outputfile);
@@ -612,6 +741,8 @@ int main(int argc, char *argv[])
       return(1);
     }
 
+    record = chunk->in + (long long)(i - chunk_first) * conv.recordbytes;
+
     if(edfplus || bdfplus)
     {
       max = edfparam[annot_ch[0]].smp_per_record * samplesize; //количество сигналов в записи данных *  samplesize(число для конкретного формата)
@@ -623,6 +754,7 @@ int main(int argc, char *argv[])
       {
         if (k>max_tal_ln) 
         {
+          stop_text_threads(&conv, chunk, i - chunk_first, (long long)chunk_first * conv.values_per_record);
           printf("Error, TAL in record %i exceeds my buffer\n", datarecordswritten + 1);
           fclose(inputfile);
           fclose(annotationfile);
@@ -635,7 +767,7 @@ int main(int argc, char *argv[])
           free(scratchpad);
           return(1);
         }
-        scratchpad[k] = cnv_buf[p + k]; //В буфер записываем cnv_buf[смещение + k]
+        scratchpad[k] = record[p + k]; //В буфер записываем cnv_buf[смещение + k]
         if (scratchpad[k]==20)
             break;
       }
@@ -661,6 +793,7 @@ int main(int argc, char *argv[])
         {
           if(k>max_tal_ln)
           {
+            stop_text_threads(&conv, chunk, i - chunk_first, (long long)chunk_first * conv.values_per_record);
             printf("Error, TAL in record %i exceeds my buffer\n", datarecordswritten + 1); //выхож за рамки
             fclose(inputfile);
             fclose(annotationfile);
@@ -675,7 +808,7 @@ int main(int argc, char *argv[])
           }
 
           //на кадой итерации n увеличивается на 1
-          scratchpad[n] = cnv_buf[p + k];
+          scratchpad[n] = record[p + k];
 
           if (scratchpad[n]==0)
           {
@@ -761,6 +894,7 @@ int main(int argc, char *argv[])
 
           if(++n>max_tal_ln)
           {
+            stop_text_threads(&conv, chunk, i - chunk_first, (long long)chunk_first * conv.values_per_record);
             printf("Error, TAL in record %i exceeds my buffer\n", datarecordswritten + 1);
             fclose(inputfile);
             fclose(annotationfile);
@@ -778,132 +912,27 @@ int main(int argc, char *argv[])
     }
     else elapsedtime = datarecordswritten * data_record_duration;
 
-/* done with timekeeping and annotations, continue with the data */
-
-    do
-    {
-      time_tmp = 10000000000.0;
-      for(j=0; j<signals; j++)
-      {
-        if(edfplus || bdfplus)
-        {
-          skip = 0;
-
-          for(p=0; p<nr_annot_chns; p++)
-          {
-            if(j==annot_ch[p])
-            {
-              skip = 1;
-              break;
-            }
-          }
-
-          if(skip)
-              continue;
-        }
-
-        d_tmp = edfparam[j].smp_written * edfparam[j].time_step; //количество сигналов в записи * промежуток времени
-        if(d_tmp<time_tmp)
-            time_tmp = d_tmp; //максимальное время
-      }
-     // fprintf(outputfile, "%f", elapsedtime + time_tmp);
-
-      for(j=0; j<signals; j++) //кол-во сигналов
-      {
-          
-        if(edfplus || bdfplus)
-        {
-          skip = 0;
-
-          for(p=0; p<nr_annot_chns; p++)
-          {
-            if(j==annot_ch[p])
-            {
-              skip = 1;
-              break;
-            }
-          }
-
-          if(skip) continue;
-        }
-
-        d_tmp = edfparam[j].smp_written * edfparam[j].time_step;
-
-        if((d_tmp<(time_tmp+0.00000000000001)) && (d_tmp>(time_tmp-0.00000000000001)) && (edfparam[j].smp_written<edfparam[j].smp_per_record))
-        {
-          if (edf)
-          {
-            value_tmp = ((*(((signed short *)cnv_buf)+edfparam[j].buf_offset+edfparam[j].smp_written)) + edfparam[j].offset) * edfparam[j].sense;
-          }
-
-          if (bdf)
-          {
-            var.two[0] = *((unsigned short *)(cnv_buf + ((edfparam[j].buf_offset + edfparam[j].smp_written) * 3)));
-            var.four[2] = *(cnv_buf + ((edfparam[j].buf_offset + edfparam[j].smp_written) * 3) + 2);
-
-            if(var.four[2]&0x80)
-            {
-              var.four[3] = 0xff;
-            }
-            else
-            {
-              var.four[3] = 0x00;
-            }
-
-            value_tmp = (var.one_signed + edfparam[j].offset) * edfparam[j].sense;
-          }
-          
-          fprintf(outputfile, "%f %d 4 * BUF1[] + SF!\r", value_tmp, zq);
-          zq += 1;
-          if (zq == 95020)
-              return(0);
-          edfparam[j].smp_written++;
-        }
-        else fputc(',', outputfile);
-      }
+  }
 
-      if(fputc('\n', outputfile)==EOF)
-      {
+  k = stop_text_threads(&conv, chunk, i - chunk_first, (long long)chunk_first * conv.values_per_record);
+  if (k)
+  {
+    if (k == 2)
+        printf("Malloc error! (text buffers)\n");
+    else
         printf("Error when writing to outputfile during conversion\n");
-        fclose(inputfile);
-        fclose(annotationfile);
-        fclose(outputfile);
-        free(edf_hdr);
-        free(edfparam);
-        free(cnv_buf);
-        free(time_in_txt);
-        free(duration_in_txt);
-        free(scratchpad);
-        return(1);
-      }
-      recordfull = 1;
-     
-      for (j=0; j<signals; j++)
-      {
-        if (edfparam[j].smp_written < edfparam[j].smp_per_record)
-        {
-          if (edfplus || bdfplus)
-          {
-            skip = 0;
-
-            for(p=0; p<nr_annot_chns; p++)
-            {
-              if(j==annot_ch[p])
-              {
-                skip = 1;
-                break;
-              }
-            }
-            if(skip) continue;
-          }
-          recordfull = 0;
-          break;
-        }
-      }
-    }
-    while(!recordfull);//шото бред, убери
-    datarecordswritten++;
+    fclose(inputfile);
+    fclose(annotationfile);
+    fclose(outputfile);
+    free(edf_hdr);
+    free(edfparam);
+    free(cnv_buf);
+    free(time_in_txt);
+    free(duration_in_txt);
+    free(scratchpad);
+    return(1);
   }
+
   fclose(inputfile);
   fclose(annotationfile);
   fclose(outputfile);
@@ -999,4 +1028,495 @@ void utf8_to_latin1(char *utf8_str)
   {
     str[j] = 0;
   }
-}
\ No newline at end of file
+}
+
+
+/* Works out once which samples, commas and newlines make up the text of a */
+/* datarecord, the same way the per-row loop of version 1.4 did for every  */
+/* datarecord. Returns 1 when a row would print no sample, where that loop */
+/* printed commas without end.                                             */
+int build_text_plan(struct textconv *conv, int signals, int *annot_ch, int nr_annot_chns)
+{
+  int j, p, skip, wrote, recordfull,
+      size=0,
+      *grown;
+
+  double time_tmp,
+         d_tmp;
+
+
+  for(j=0; j<signals; j++)
+      edfparam[j].smp_written = 0;
+
+  conv->plan_len = 0;
+  conv->values_per_record = 0;
+
+  do
+  {
+    time_tmp = 10000000000.0;
+    for(j=0; j<signals; j++)
+    {
+      skip = 0;
+      for(p=0; p<nr_annot_chns; p++)
+      {
+        if(j==annot_ch[p])
+        {
+          skip = 1;
+          break;
+        }
+      }
+      if(skip)
+          continue;
+
+      d_tmp = edfparam[j].smp_written * edfparam[j].time_step;
+      if(d_tmp<time_tmp)
+          time_tmp = d_tmp;
+    }
+
+    wrote = 0;
+
+    for(j=0; j<=signals; j++)
+    {
+      if(conv->plan_len == size)
+      {
+        size = size ? size * 2 : 1024;
+        grown = (int *)realloc(conv->plan_sig, size * sizeof(int));
+        if(grown==NULL)
+            return(1);
+        conv->plan_sig = grown;
+        grown = (int *)realloc(conv->plan_smp, size * sizeof(int));
+        if(grown==NULL)
+            return(1);
+        conv->plan_smp = grown;
+      }
+
+      if(j==signals)
+      {
+        conv->plan_sig[conv->plan_len++] = -2;
+        break;
+      }
+
+      skip = 0;
+      for(p=0; p<nr_annot_chns; p++)
+      {
+        if(j==annot_ch[p])
+        {
+          skip = 1;
+          break;
+        }
+      }
+      if(skip)
+          continue;
+
+      d_tmp = edfparam[j].smp_written * edfparam[j].time_step;
+
+      if((d_tmp<(time_tmp+0.00000000000001)) && (d_tmp>(time_tmp-0.00000000000001)) && (edfparam[j].smp_written<edfparam[j].smp_per_record))
+      {
+        conv->plan_sig[conv->plan_len] = j;
+        conv->plan_smp[conv->plan_len] = edfparam[j].buf_offset + edfparam[j].smp_written;
+        edfparam[j].smp_written++;
+        conv->values_per_record++;
+        wrote = 1;
+      }
+      else conv->plan_sig[conv->plan_len] = -1;
+
+      conv->plan_len++;
+    }
+
+    recordfull = 1;
+    for(j=0; j<signals; j++)
+    {
+      if(edfparam[j].smp_written < edfparam[j].smp_per_record)
+      {
+        skip = 0;
+        for(p=0; p<nr_annot_chns; p++)
+        {
+          if(j==annot_ch[p])
+          {
+            skip = 1;
+            break;
+          }
+        }
+        if(skip)
+            continue;
+
+        recordfull = 0;
+        break;
+      }
+    }
+
+    if(!wrote && !recordfull)
+        return(1);
+  }
+  while(!recordfull);
+
+  return(0);
+}
+
+
+int start_text_threads(struct textconv *conv, int threads, int chunk_records)
+{
+  int i;
+
+
+  conv->nchunks = threads * 2 + 2;
+  conv->chunks = (struct textchunk *)calloc(conv->nchunks, sizeof(struct textchunk));
+  conv->threads = (pthread_t *)calloc(threads + 1, sizeof(pthread_t));
+  if((conv->chunks==NULL) || (conv->threads==NULL))
+      return(1);
+
+  for(i=0; i<conv->nchunks; i++)
+  {
+    conv->chunks[i].out_size = (long long)chunk_records * (conv->values_per_record * 48LL + conv->plan_len) + 1024;
+    conv->chunks[i].in = (char *)malloc((size_t)conv->recordbytes * chunk_records);
+    conv->chunks[i].out = (char *)malloc(conv->chunks[i].out_size);
+    if((conv->chunks[i].in==NULL) || (conv->chunks[i].out==NULL))
+        return(1);
+  }
+
+  pthread_mutex_init(&conv->lock, NULL);
+  pthread_cond_init(&conv->cond, NULL);
+
+  if(pthread_create(conv->threads, NULL, write_text_thread, conv))
+      return(1);
+  conv->nthreads = 1;
+
+  for(i=0; i<threads; i++)
+  {
+    if(pthread_create(conv->threads + conv->nthreads, NULL, format_text_thread, conv))
+        break;
+    conv->nthreads++;
+  }
+
+  return(0);
+}
+
+
+/* waits for the chunk after the last one handed out to be written, NULL on an error */
+struct textchunk *next_text_chunk(struct textconv *conv)
+{
+  struct textchunk *chunk;
+
+
+  chunk = conv->chunks + conv->n_read % conv->nchunks;
+
+  pthread_mutex_lock(&conv->lock);
+  while((chunk->state!=CHUNK_FREE) && !conv->failed)
+      pthread_cond_wait(&conv->cond, &conv->lock);
+  if(conv->failed)
+      chunk = NULL;
+  pthread_mutex_unlock(&conv->lock);
+
+  return(chunk);
+}
+
+
+void queue_text_chunk(struct textconv *conv, struct textchunk *chunk, int records, long long first_value)
+{
+  chunk->records = records;
+  chunk->first_value = first_value;
+
+  pthread_mutex_lock(&conv->lock);
+  chunk->state = CHUNK_READ;
+  conv->n_read++;
+  pthread_cond_broadcast(&conv->cond);
+  pthread_mutex_unlock(&conv->lock);
+}
+
+
+/* queues the last records, waits until all text is written and frees the */
+/* buffers; returns 1 on a write error, 2 when memory ran out             */
+int stop_text_threads(struct textconv *conv, struct textchunk *chunk, int records, long long first_value)
+{
+  int i;
+
+
+  if((chunk!=NULL) && (records>0))
+      queue_text_chunk(conv, chunk, records, first_value);
+
+  pthread_mutex_lock(&conv->lock);
+  conv->done = 1;
+  pthread_cond_broadcast(&conv->cond);
+  pthread_mutex_unlock(&conv->lock);
+
+  for(i=0; i<conv->nthreads; i++)
+      pthread_join(conv->threads[i], NULL);
+
+  pthread_mutex_destroy(&conv->lock);
+  pthread_cond_destroy(&conv->cond);
+
+  for(i=0; i<conv->nchunks; i++)
+  {
+    free(conv->chunks[i].in);
+    free(conv->chunks[i].out);
+  }
+  free(conv->chunks);
+  free(conv->threads);
+  free(conv->plan_sig);
+  free(conv->plan_smp);
+
+  return(conv->failed);
+}
+
+
+void *format_text_thread(void *arg)
+{
+  struct textconv *conv = (struct textconv *)arg;
+
+  struct textchunk *chunk;
+
+  int failed;
+
+
+  pthread_mutex_lock(&conv->lock);
+
+  for(;;)
+  {
+    while((conv->n_formatted==conv->n_read) && !conv->done)
+        pthread_cond_wait(&conv->cond, &conv->lock);
+
+    if(conv->n_formatted==conv->n_read)
+        break;
+
+    chunk = conv->chunks + conv->n_formatted++ % conv->nchunks;
+
+    pthread_mutex_unlock(&conv->lock);
+    failed = format_text_chunk(conv, chunk);
+    pthread_mutex_lock(&conv->lock);
+
+    if(failed && !conv->failed)
+        conv->failed = 2;
+    chunk->state = CHUNK_FORMATTED;
+    pthread_cond_broadcast(&conv->cond);
+  }
+
+  pthread_mutex_unlock(&conv->lock);
+
+  return(NULL);
+}
+
+
+/* writes the text of the chunks in the order they were read */
+void *write_text_thread(void *arg)
+{
+  struct textconv *conv = (struct textconv *)arg;
+
+  struct textchunk *chunk;
+
+  int failed;
+
+
+  pthread_mutex_lock(&conv->lock);
+
+  for(;;)
+  {
+    chunk = conv->chunks + conv->n_written % conv->nchunks;
+
+    while(!((conv->n_written<conv->n_read) && (chunk->state==CHUNK_FORMATTED)) && !(conv->done && (conv->n_written==conv->n_read)))
+        pthread_cond_wait(&conv->cond, &conv->lock);
+
+    if(conv->n_written==conv->n_read)
+        break;
+
+    failed = conv->failed;
+
+    pthread_mutex_unlock(&conv->lock);
+    if(!failed && chunk->out_len && (fwrite(chunk->out, chunk->out_len, 1, conv->outputfile)!=1))
+        failed = 1;
+    pthread_mutex_lock(&conv->lock);
+
+    if(failed && !conv->failed)
+        conv->failed = failed;
+    chunk->state = CHUNK_FREE;
+    conv->n_written++;
+    pthread_cond_broadcast(&conv->cond);
+  }
+
+  pthread_mutex_unlock(&conv->lock);
+
+  return(NULL);
+}
+
+
+/* the text of the datarecords of a chunk, "value index\r" per sample; */
+/* stops after max_values samples unless that is 0                     */
+int format_text_chunk(struct textconv *conv, struct textchunk *chunk)
+{
+
+  const unsigned char *rec;
+
+  char *grown;
+
+  long long len=0,
+            value;
+
+  int r, t, sig, smp, digital;
+
+
+  value = chunk->first_value;
+
+  for(r=0; r<chunk->records; r++)
+  {
+    rec = (const unsigned char *)chunk->in + (long long)r * conv->recordbytes;
+
+    for(t=0; t<conv->plan_len; t++)
+    {
+      if(chunk->out_size - len < 512)
+      {
+        grown = (char *)realloc(chunk->out, chunk->out_size * 2);
+        if(grown==NULL)
+        {
+          chunk->out_len = len;
+          return(1);
+        }
+        chunk->out = grown;
+        chunk->out_size *= 2;
+      }
+
+      sig = conv->plan_sig[t];
+
+      if(sig==-1)
+      {
+        chunk->out[len++] = ',';
+        continue;
+      }
+
+      if(sig==-2)
+      {
+        chunk->out[len++] = '\n';
+        continue;
+      }
+
+      smp = conv->plan_smp[t];
+
+      if(conv->bdf)
+      {
+        digital = rec[smp * 3] | (rec[smp * 3 + 1] << 8) | (rec[smp * 3 + 2] << 16);
+        if(digital & 0x800000)
+            digital -= 0x1000000;
+      }
+      else digital = (signed short)(rec[smp * 2] | (rec[smp * 2 + 1] << 8));
+
+      len += format_fixed(chunk->out + len, (digital + edfparam[sig].offset) * edfparam[sig].sense);
+      chunk->out[len++] = ' ';
+      len += format_int(chunk->out + len, value);
+      chunk->out[len++] = '\r';
+
+      if(++value==conv->max_values)
+      {
+        chunk->out_len = len;
+        return(0);
+      }
+    }
+  }
+
+  chunk->out_len = len;
+
+  return(0);
+}
+
+
+/* writes value the way printf("%f") does in the C locale: exactly rounded, */
+/* ties to even; returns the number of characters                          */
+int format_fixed(char *dst, double value)
+{
+#ifdef __SIZEOF_INT128__
+  unsigned long long bits, mant, q, ip;
+
+  unsigned __int128 n, rem, half;
+
+  int exp, i, len=0;
+
+  char digits[24];
+
+
+  memcpy(&bits, &value, 8);
+  exp = (int)((bits >> 52) & 0x7ff);
+  mant = bits & 0xfffffffffffffULL;
+
+  /* infinities, NaN and numbers of more than twelve digits */
+  if((exp==0x7ff) || (value>=1e12) || (value<=-1e12))
+      return(sprintf(dst, "%f", value));
+
+  if(exp)
+      mant |= 1ULL << 52;
+  else
+      exp = 1;
+  exp -= 1075;  /* value is mant * 2^exp, exp < 0 */
+
+  /* value * 10^6 rounded to an integer */
+  n = (unsigned __int128)mant * 1000000;
+  if(exp < -100)
+  {
+    n = 0;
+  }
+  else
+  {
+    rem = n & ((((unsigned __int128)1) << -exp) - 1);
+    half = ((unsigned __int128)1) << (-exp - 1);
+    n >>= -exp;
+    if((rem > half) || ((rem == half) && (n & 1)))
+        n++;
+  }
+  q = (unsigned long long)n;
+
+  if(bits >> 63)
+      dst[len++] = '-';
+
+  ip = q / 1000000;
+  q %= 1000000;
+
+  i = 0;
+  do
+  {
+    digits[i++] = '0' + ip % 10;
+    ip /= 10;
+  }
+  while(ip);
+
+  while(i)
+      dst[len++] = digits[--i];
+
+  dst[len++] = '.';
+
+  for(i=5; i>=0; i--)
+  {
+    dst[len + i] = '0' + q % 10;
+    q /= 10;
+  }
+
+  return(len + 6);
+#else
+  return(sprintf(dst, "%f", value));
+#endif
+}
+
+
+int format_int(char *dst, long long value)
+{
+  unsigned long long u;
+
+  int i=0, len=0;
+
+  char digits[24];
+
+
+  u = value;
+  if(value < 0)
+  {
+    dst[len++] = '-';
+    u = 0 - u;
+  }
+
+  do
+  {
+    digits[i++] = '0' + u % 10;
+    u /= 10;
+  }
+  while(u);
+
+  while(i)
+      dst[len++] = digits[--i];
+
+  return(len);
+}
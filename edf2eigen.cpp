@@ -28,988 +28,523 @@
 *
 ***************************************************************************
 */
-#include <Eigen/Dense>
 #include <iostream>
+#include <string>
 #include <vector>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#if !defined(__APPLE__) && !defined(__MACH__) && !defined(__APPLE_CC__)
-#include <malloc.h>
-#endif
 #include <locale.h>
+#include "edfreader.h"
+#include "edfcache.h"
+#include "edfcatalog.h"
+#include "edfmatrix.h"
+#include "edfnpy.h"
 using namespace std;
-using Eigen::MatrixXd;
-
-void utf8_to_latin1(char*);
-MatrixXd vector2eigen(vector<double>);
-int main_origin(int, char* []);
-
-struct edfparamblock {
-    int smp_per_record;
-    int smp_written; //количество сигналов в записи
-    int dig_min;
-    int dig_max;
-    double offset;
-    int buf_offset;
-    double phys_min;
-    double phys_max;
-    double time_step;
-    double sense;
-} *edfparam;
-
-vector<double> val;
-MatrixXd mat;
-
-int main(int argc, char* argv[]) {
-    int code = main_origin(argc, argv);
-    if (code)
-        return 1;
-    mat = vector2eigen(val);
-    cout << mat << endl;
-    return 0;
+
+/* prints len bytes of the header, commas replaced by single quotes because they */
+/* interfere with the comma-separated txt-files                                  */
+static void put_field(FILE* f, const char* s, int len, char sep)
+{
+    for (int i = 0; i < len; i++)
+        fputc(s[i] == ',' ? '\'' : s[i], f);
+    fputc(sep, f);
 }
 
-int main_origin(int argc, char* argv[])
+static FILE* open_sidecar(char* ascii_path, int pathlen, const char* suffix)
 {
-    FILE* inputfile,
-        * outputfile,
-        * annotationfile;
-
-    const char* fileName;
-
-    int i, j, k, p, r, m, n,
-        pathlen,
-        fname_len,
-        signals,
-        datarecords,
-        datarecordswritten,
-        recordsize,
-        recordfull,
-        edf = 0,
-        bdf = 0,
-        edfplus = 0,
-        bdfplus = 0,
-        annot_ch[256],
-        nr_annot_chns,
-        skip,
-        max,
-        onset,
-        duration,
-        zero,
-        max_tal_ln,
-        samplesize;
-
-    char path[512],
-        ascii_path[512],
-        * edf_hdr,
-        * scratchpad,
-        * cnv_buf,
-        * time_in_txt,
-        * duration_in_txt;
-
-    double data_record_duration,
-        elapsedtime,
-        time_tmp,
-        d_tmp,
-        value_tmp = 0.0;
-
-    union {
-        unsigned int one;
-        signed int one_signed;
-        unsigned short two[2];
-        signed short two_signed[2];
-        unsigned char four[4];
-    } var;
+    FILE* f;
 
+    ascii_path[pathlen - 4] = 0;
+    strcat(ascii_path, suffix);
+    f = fopen(ascii_path, "wb");
 
+    if (f == NULL)
+        printf("Error, can not open file %s for writing\n", ascii_path);
 
-    setlocale(LC_ALL, "C");
+    return f;
+}
 
-    if (argc != 2)
-    {
-        printf("%d", argc);
+static int write_header(EdfReader& reader, char* ascii_path, int pathlen)
+{
+    FILE* outputfile;
 
-        printf("\nEDF(+) or BDF(+) to Eigen converter version 0.0.1\n"
-            "Usage: edf2eigen <filename>\n\n");
-        return(1);
-    }
+    const char* edf_hdr = reader.header();
 
-    /*Проверка на валидность пути*/
-    strcpy(path, argv[1]);
-    strcpy(ascii_path, argv[1]);
-    /*path - путь к файлу который ворочяем*/
-    pathlen = strlen(path); // длинна пути с названием
+    int i, c, signals = reader.signals();
 
-    if (pathlen < 5)
-    {
-        printf("Error, filename must contain at least five characters.\n");
+    if ((outputfile = open_sidecar(ascii_path, pathlen, "_header.txt")) == NULL)
         return(1);
-    }
 
-    scratchpad = (char*)malloc(128); // создаем буфер на паять 128 байт 
+    fprintf(outputfile, "Version,Patient,Recording,Startdate,Startime,Bytes,Reserved,NumRec,Duration,NumSig\n");
 
-    if (scratchpad == NULL) // проверка выделения памяти
+    if (reader.is_bdf())
     {
-        printf("Malloc error! (scratchpad).\n");
-        return(1);
+        fputc('.', outputfile);
+        put_field(outputfile, edf_hdr + 1, 7, ',');
     }
-
-    //Считаем длину имени файла
-    fname_len = 0;
-    for (i = pathlen; i > 0; i--)
+    else
     {
-        if ((path[i - 1] == '/') || (path[i - 1] == '\\'))  break;
-        fname_len++; //колличество символов  в имени файла + расширения
+        put_field(outputfile, edf_hdr, 8, ',');
     }
-    fileName = path + pathlen - fname_len; //неизменяемый указатель на массив
 
-    for (i = 0; fileName[i] != 0; i++); //проверка существования path
-    if (i == 0)
-    {
-        printf("Error, filename must contain at least five characters.\n");
-        return(1);
-    }
+    put_field(outputfile, edf_hdr + 8, 80, ',');
+    put_field(outputfile, edf_hdr + 88, 80, ',');
+    put_field(outputfile, edf_hdr + 168, 8, ',');
+    put_field(outputfile, edf_hdr + 176, 8, ',');
+    put_field(outputfile, edf_hdr + 184, 8, ',');
+    put_field(outputfile, edf_hdr + 192, 44, ',');
+    fprintf(outputfile, "%i,", reader.datarecords());
+    put_field(outputfile, edf_hdr + 244, 8, ',');
+    fprintf(outputfile, "%i\n", reader.columns());
 
-    i -= 4; //зная что расширения занимает 4 слота убираем их и делаем проверку на формат
-    if ((strcmp((const char*)fileName + i, ".edf")) &&
-        (strcmp((const char*)fileName + i, ".EDF")) &&
-        (strcmp((const char*)fileName + i, ".bdf")) &&
-        (strcmp((const char*)fileName + i, ".BDF")))
-    {
-        printf("Error, filename extension must have the form \".edf\" or \".EDF\" or \".bdf\" or \".BDF\"\n");
-        return(1);
-    }
+    fclose(outputfile);
 
-    if ((!strcmp((const char*)fileName + i, ".edf")) ||  // проверка наличия чего то кроме рассширения и путь
-        (!strcmp((const char*)fileName + i, ".EDF")))
-    {
-        edf = 1;
-        samplesize = 2;
-    }
-    else
-    {
-        bdf = 1;
-        samplesize = 3;
-    }
+    /***************** write signals ******************************/
 
-    /***************** check header ******************************/
+    if ((outputfile = open_sidecar(ascii_path, pathlen, "_signals.txt")) == NULL)
+        return(1);
 
-    inputfile = fopen(path, "rb"); //открываем файл
+    fprintf(outputfile, "Signal,Label,Transducer,Units,Min,Max,Dmin,Dmax,PreFilter,Smp/Rec,Reserved\n");
 
-    if (inputfile == NULL) //проверка на наличие файла
+    for (c = 0; c < reader.columns(); c++)
     {
-        printf("Error, can not open file %s for reading\n", path);
-        return(1);
-    }
+        i = reader.column_signal(c);
 
-    if (fseek(inputfile, 0xfc, SEEK_SET)) //проверка правильности структуры
-    {
-        printf("Error, reading file %s\n", path);
-        fclose(inputfile);
-        return(1);
+        fprintf(outputfile, "%i,", i + 1);
+        put_field(outputfile, edf_hdr + 256 + i * 16, 16, ',');
+        put_field(outputfile, edf_hdr + 256 + signals * 16 + i * 80, 80, ',');
+        put_field(outputfile, edf_hdr + 256 + signals * 96 + i * 8, 8, ',');
+        fprintf(outputfile, "%f,", reader.param(i).phys_min);
+        fprintf(outputfile, "%f,", reader.param(i).phys_max);
+        fprintf(outputfile, "%i,", reader.param(i).dig_min);
+        fprintf(outputfile, "%i,", reader.param(i).dig_max);
+        put_field(outputfile, edf_hdr + 256 + signals * 136 + i * 80, 80, ',');
+        fprintf(outputfile, "%i,", reader.param(i).smp_per_record);
+        put_field(outputfile, edf_hdr + 256 + signals * 224 + i * 32, 32, '\n');
     }
 
-    if (fread(scratchpad, 4, 1, inputfile) != 1) // считываем 1 элемент весом 4 байта из потока input в scratch проверка на наличие чего либо в файле
-    {
-        printf("Error, reading file %s\n", path);
-        fclose(inputfile);
-        return(1);
-    }
+    fclose(outputfile);
 
+    return(0);
+}
 
-    scratchpad[4] = 0; //Ставим '\0'
-    signals = atoi(scratchpad);// signals адресс в форме int
-    printf("signals %d", signals);
-    if ((signals < 1) || (signals > 256)) //указатель на скречпад конвертированый в инт должен находится в пределах
-    {
-        printf("Error, number of signals in header is %i\n", signals);
-        fclose(inputfile);
-        return(1);
-    }
+/* parses a comma separated list of signal numbers (counting from 1) or labels */
+static int select_signals(EdfReader& reader, const char* list)
+{
+    vector<int> signals;
 
-    edf_hdr = (char*)malloc((signals + 1) * 256);// теперь для каждого сигнала добавляем еще 256байт
+    string item;
 
-    if (edf_hdr == NULL) // проверка малока
-    {
-        printf("Malloc error! (edf_hdr)\n");
-        fclose(inputfile);
-        return(1);
-    }
+    const char* p = list;
 
-    rewind(inputfile); // возвращаем указатель в файле на начало указаного потока
+    int i;
 
-    //Запись в edf_hdr  (signals + 1) * 256 байт
-    if (fread(edf_hdr, (signals + 1) * 256, 1, inputfile) != 1) //проверка есть ли что то в inputfile
+    for (;;)
     {
-        printf("Error, reading file %s\n", path);
-        fclose(inputfile);
-        free(edf_hdr);
-        return(1);
-    }
+        if ((*p == ',') || (*p == 0))
+        {
+            for (i = 0; (i < (int)item.size()) && (item[i] >= '0') && (item[i] <= '9'); i++);
 
-    for (i = 0; i < ((signals + 1) * 256); i++) //проходимся по всем блокам памяти и меняем все , на 
-    {
-        if (edf_hdr[i] == ',')
-            edf_hdr[i] = '\'';  /* replace all comma's in header by single quotes because they */
-    }                        /* interfere with the comma-separated txt-files                */
+            if (!item.empty() && (i == (int)item.size()))
+                signals.push_back(atoi(item.c_str()) - 1);
+            else if ((i = reader.find_signal(item.c_str())) >= 0)
+                signals.push_back(i);
+            else
+            {
+                printf("Error, there is no signal with label \"%s\"\n", item.c_str());
+                return(1);
+            }
 
-     //если edf формат
-    if (edf)
-    {
-        if (strncmp(edf_hdr, "0       ", 8))//сравниваем первые 8 элементов если строки равны вернется 0 ищем версию
-        {
-            printf("Error, EDF-header has unknown version\n");
-            fclose(inputfile);
-            free(edf_hdr);
-            return(1);
-        }
-    }
+            item.clear();
 
-    if (bdf)
-    {
-        if (strncmp(edf_hdr + 1, "BIOSEMI", 7) || (edf_hdr[0] != -1)) //сравниваем первые 7 элементов если строки равны вернется 0 ищем версию
-        {
-            printf("Error, BDF-header has unknown version\n");
-            fclose(inputfile);
-            free(edf_hdr);
-            return(1);
+            if (*p++ == 0)
+                break;
         }
+        else item += *p++;
     }
 
-    strncpy(scratchpad, edf_hdr + 0xec, 8); //скоприровать 8 байт edf в scratch
-    scratchpad[8] = 0; //Добавляем в конец строки символ конца
-    datarecords = atoi(scratchpad); //конвертируем в инт
-
-    if (datarecords < 1) //проверка на существование
+    if (reader.select_signals(signals))
     {
-        printf("Error, number of datarecords in header is %i\n", datarecords);
-        fclose(inputfile);
-        free(edf_hdr);
+        printf("%s\n", reader.error());
         return(1);
     }
 
-    strncpy(scratchpad, edf_hdr + 0xf4, 8); //сдвигаем на 8 и копируем 8 байт в scratch 
-    scratchpad[8] = 0;
-    data_record_duration = atof(scratchpad); // приводим в int вычесляем длительность записи данных в секундах
-
-    //позиция указателя анотации в массиве annot_ch
-    nr_annot_chns = 0;
+    return(0);
+}
 
-    if ((strncmp(edf_hdr + 0xc0, "EDF+C     ", 10)) && (strncmp(edf_hdr + 0xc0, "EDF+D     ", 10))) // сравниваем 10 символов со 192 в edf
-    {
-        edfplus = 0; // проверка ???
-    }
-    else
-    {
-        edfplus = 1;
-        for (i = 0; i < signals; i++) //цикл прохода по всем сигналам
-        {
-            if (!(strncmp(edf_hdr + 256 + i * 16, "EDF Annotations ", 16)))//ищем анотацию
-            {
-                annot_ch[nr_annot_chns] = i; // записываем позицию элемента аннотации
-                nr_annot_chns++;
-                if (nr_annot_chns > 255)
-                    break; //проверка на конец 
-            }
-        }
-        //В annot_ch храняться указатели на начала аннотаций
+/* prints the annotations of the selection as onset,duration,text lines */
+static int print_annotations(EdfReader& reader)
+{
+    const EdfAnnotations& annots = reader.annotations();
 
-        //Если нет аннотаций return (всё exit, Андрей)
-        if (!nr_annot_chns)
-        {
-            printf("Error, file is marked as EDF+ but it has no annotationsignal.\n"); // 
-            fclose(inputfile);
-            free(edf_hdr);
-            return(1);
-        }
-    }
-    edfparam = (struct edfparamblock*)malloc(signals * sizeof(struct edfparamblock)); //выделение памяти для заполнения структуры
+    int i;
 
+    char* p;
 
-    if (edfparam == NULL) //проверка малока
+    if (reader.read_annotations())
     {
-        printf("Malloc error! (edfparam)\n");
-        fclose(inputfile);
-        free(edf_hdr);
+        printf("%s\n", reader.error());
         return(1);
     }
 
-    recordsize = 0;
+    printf("Onset,Duration,Annotation\n");
 
-    for (i = 0; i < signals; i++)
+    for (i = 0; i < annots.size(); i++)
     {
-        strncpy(scratchpad, edf_hdr + 256 + signals * 216 + i * 8, 8);// копируем 8байт в скрэтч из эдф
-        scratchpad[8] = 0; //конечный элемент
-        edfparam[i].smp_per_record = atoi(scratchpad); //количество сигналов в записи данных
-        edfparam[i].buf_offset = recordsize;
-        recordsize += edfparam[i].smp_per_record;
-
-        strncpy(scratchpad, edf_hdr + 256 + signals * 104 + i * 8, 8);// копируем 8байт в скрэтч из эдф
-        scratchpad[8] = 0;
-        edfparam[i].phys_min = atof(scratchpad); //физический минимум
-        strncpy(scratchpad, edf_hdr + 256 + signals * 112 + i * 8, 8);// копируем 8байт в скрэтч из эдф
-        scratchpad[8] = 0;
-        edfparam[i].phys_max = atof(scratchpad);//физический максимум
-        strncpy(scratchpad, edf_hdr + 256 + signals * 120 + i * 8, 8);// копируем 8байт в скрэтч из эдф
-        scratchpad[8] = 0;
-        edfparam[i].dig_min = atoi(scratchpad);//Цифровой минимум
-        strncpy(scratchpad, edf_hdr + 256 + signals * 128 + i * 8, 8);// копируем 8байт в скрэтч из эдф
-        scratchpad[8] = 0;
-
-        edfparam[i].dig_max = atoi(scratchpad);//Цифровой максимум
-
-        edfparam[i].time_step = data_record_duration / edfparam[i].smp_per_record; //продолжительность записи данных в секунду
-        edfparam[i].sense = (edfparam[i].phys_max - edfparam[i].phys_min) / (edfparam[i].dig_max - edfparam[i].dig_min); //училение
-        edfparam[i].offset = edfparam[i].phys_max / edfparam[i].sense - edfparam[i].dig_max;
-    }
+        string text(annots.text(i), annots[i].length);
 
-    cnv_buf = (char*)malloc(recordsize * samplesize);//количество сигналов в записи данных * размер сигнала
-    if (cnv_buf == NULL)
-    {
-        printf("Malloc error! (cnv_buf)\n"); //проверка малока
-        fclose(inputfile);
-        free(edf_hdr);
-        free(edfparam);
-        return(1);
-    }
-    free(scratchpad);
+        for (p = &text[0]; *p; p++)
+        {
+            if ((((unsigned char*)p)[0] < 32) || (*p == ','))
+                *p = '.';
+        }
 
-    max_tal_ln = 0;
-    for (r = 0; r < nr_annot_chns; r++)
-    {
-        if (max_tal_ln < edfparam[annot_ch[r]].smp_per_record * samplesize)
-            max_tal_ln = edfparam[annot_ch[r]].smp_per_record * samplesize; //присваимаем максималльное значение
+        if (annots[i].duration >= 0.0)
+            printf("%f,%f,%s\n", annots[i].onset, annots[i].duration, text.c_str());
+        else
+            printf("%f,,%s\n", annots[i].onset, text.c_str());
     }
 
-    if (max_tal_ln < 128)
-        max_tal_ln = 128;
+    return(0);
+}
 
-    scratchpad = (char*)malloc(max_tal_ln + 3); //выделяем чуть больше памяти
+/* indexes the headers of all files below dir */
+static int build_catalog(const char* index, const char* dir, int threads)
+{
+    EdfCatalog cat;
 
-    if (scratchpad == NULL)
+    if (cat.build(dir, threads) || cat.save(index))
     {
-        printf("Malloc error! (scratchpad)\n"); // проверка малока
-        fclose(inputfile);
-        free(cnv_buf);
-        free(edf_hdr);
-        free(edfparam);
+        printf("%s\n", cat.error());
         return(1);
     }
 
-    //направление в txt
-    duration_in_txt = (char*)malloc(max_tal_ln + 3); //указатель на память значений
-    if (duration_in_txt == NULL)
-    {
-        printf("Malloc error! (duration_in_txt)\n"); // проверка малока
-        fclose(inputfile);
-        free(scratchpad);
-        free(cnv_buf);
-        free(edf_hdr);
-        free(edfparam);
-        return(1);
-    }
+    printf("%i files in %s", cat.files(), index);
+    if (cat.skipped())
+        printf(", %i not readable as EDF or BDF", cat.skipped());
+    printf("\n");
 
-    //время в txt
-    time_in_txt = (char*)malloc(max_tal_ln + 3);//указатель на память времени
-    if (time_in_txt == NULL)
-    {
-        printf("Malloc error! (time_in_txt)\n");
-        fclose(inputfile);
-        free(duration_in_txt);
-        free(scratchpad);
-        free(cnv_buf);
-        free(edf_hdr);
-        free(edfparam);
-        return(1);
-    }
+    return(0);
+}
 
-    /***************** write header ******************************/
+/* path,label,samplerate for every file with a matching signal */
+static int query_catalog(const char* index, const char* label, double min_rate)
+{
+    EdfCatalog cat;
 
-    ascii_path[pathlen - 4] = 0;
-    strcat(ascii_path, "_header.txt");
-    outputfile = fopen(ascii_path, "wb");
+    int j;
 
-    if (outputfile == NULL)//проверка открытия файла
+    if (cat.load(index))
     {
-        printf("Error, can not open file %s for writing\n", ascii_path);
-        fclose(inputfile);
-        free(edf_hdr);
-        free(edfparam);
-        free(cnv_buf);
-        free(time_in_txt);
-        free(duration_in_txt);
-        free(scratchpad);
+        printf("%s\n", cat.error());
         return(1);
     }
 
-    fprintf(outputfile, "Version,Patient,Recording,Startdate,Startime,Bytes,Reserved,NumRec,Duration,NumSig\n");
-
-    if (edf)
-    {
-        fprintf(outputfile, "%.8s,", edf_hdr); //версия формата данных
-    }
-    else
+    for (int f : cat.find(label, min_rate))
     {
-        fprintf(outputfile, ".%.7s,", edf_hdr + 1);
-    }
+        j = cat.find_signal(f, label, min_rate);
 
-    fprintf(outputfile, "%.80s,", edf_hdr + 8); //пациент
-    fprintf(outputfile, "%.80s,", edf_hdr + 88);//локальной запсии идентификация
-    fprintf(outputfile, "%.8s,", edf_hdr + 168);//дата
-    fprintf(outputfile, "%.8s,", edf_hdr + 176);//время начала записи
-    fprintf(outputfile, "%.8s,", edf_hdr + 184); //коллчество байт в записи заголовка
-    fprintf(outputfile, "%.44s,", edf_hdr + 192);//резерв
-    fprintf(outputfile, "%i,", datarecords); //количество записей данных
-    fprintf(outputfile, "%.8s,", edf_hdr + 244);// длительность записи данных в секундах
-    sprintf(scratchpad, "%.4s", edf_hdr + 252);
-    fprintf(outputfile, "%i\n", atoi(scratchpad) - nr_annot_chns); // количество сигналов в записи данных
+        printf("%s,%s,%f\n", cat.path(f), cat.text(cat.signal(j).label), cat.signal(j).samplerate);
+    }
 
-    fclose(outputfile);
+    return(0);
+}
 
-    /***************** write signals ******************************/
+/* decodes into Scalar, into the sink chosen on the command line */
+template<typename Scalar>
+static int decode(EdfReader& reader, int channels, int block_records, int null_output,
+    const char* output_path, const char* npy_path, const char* npz_path, EdfCache* cache, const char* path)
+{
+    EdfTextSink<Scalar> text(cout);
+    EdfNullSink<Scalar> null;
+    EdfMatrixFileSink<Scalar> matrix_file(output_path != NULL ? output_path : "");
+    EdfNpySink<Scalar> npy(npy_path != NULL ? npy_path : "");
+    EdfSink<Scalar>* sink = &text;
 
-    ascii_path[pathlen - 4] = 0;
-    strcat(ascii_path, "_signals.txt");
-    outputfile = fopen(ascii_path, "wb");
+    EdfNpyWriter npz;
 
-    if (outputfile == NULL) //проверка открытия
+    /* one array per channel needs each channel whole */
+    if (npz_path != NULL)
     {
-        printf("Error, can not open file %s for writing\n", ascii_path);
-        fclose(inputfile);
-        free(edf_hdr);
-        free(edfparam);
-        free(cnv_buf);
-        free(time_in_txt);
-        free(duration_in_txt);
-        free(scratchpad);
-        return(1);
+        if (npz.write_npz<Scalar>(npz_path, reader))
+        {
+            printf("%s\n", npz.error());
+            return(1);
+        }
+
+        return(0);
     }
 
-    fprintf(outputfile, "Signal,Label,Transducer,Units,Min,Max,Dmin,Dmax,PreFilter,Smp/Rec,Reserved\n");
+    if (null_output)
+        sink = &null;
+    else if (output_path != NULL)
+        sink = &matrix_file;
+    else if (npy_path != NULL)
+        sink = &npy;
 
-    for (i = 0; i < signals; i++)
+    if (cache != NULL)
     {
-        //Считаем количество сигналов
-        if (edfplus || bdfplus)
+        if (cache->read<Scalar>(path, reader, channels != 0, *sink))
         {
-            skip = 0;
+            if (sink == &text)
+                cout << endl;
 
-            for (j = 0; j < nr_annot_chns; j++)
-            {
-                if (i == annot_ch[j])
-                    skip = 1;
-            }
-
-            if (skip)
-                continue;
+            printf("%s\n", cache->error());
+            return(1);
         }
 
-        fprintf(outputfile, "%i,", i + 1);//колличество сигналов
-        fprintf(outputfile, "%.16s,", edf_hdr + 256 + i * 16); //название
-        fprintf(outputfile, "%.80s,", edf_hdr + 256 + signals * 16 + i * 80); // метка о преобразователе
-        fprintf(outputfile, "%.8s,", edf_hdr + 256 + signals * 96 + i * 8); //тип датчика
-        fprintf(outputfile, "%f,", edfparam[i].phys_min); //физический минимум
-        fprintf(outputfile, "%f,", edfparam[i].phys_max);//физический максимум
-        fprintf(outputfile, "%i,", edfparam[i].dig_min);//цифровой минимум 
-        fprintf(outputfile, "%i,", edfparam[i].dig_max); //цифровой максимум
-        fprintf(outputfile, "%.80s,", edf_hdr + 256 + signals * 136 + i * 80); //предварительная фильтрация
-        fprintf(outputfile, "%i,", edfparam[i].smp_per_record); //выборок в каждой запсии
-        fprintf(outputfile, "%.32s\n", edf_hdr + 256 + signals * 224 + i * 32);//резерв
+        return(0);
     }
 
-    fclose(outputfile);
-
-    /***************** open annotation file ******************************/
-
-    ascii_path[pathlen - 4] = 0;
-    strcat(ascii_path, "_annotations.txt");
-    annotationfile = fopen(ascii_path, "wb");
-
-    if (annotationfile == NULL)
+    if (channels ? reader.read_channels(*sink, block_records) : reader.read(*sink, block_records))
     {
-        printf("Error, can not open file %s for writing\n", ascii_path);
-        fclose(inputfile);
-        free(edf_hdr);
-        free(edfparam);
-        free(cnv_buf);
-        free(time_in_txt);
-        free(duration_in_txt);
-        free(scratchpad);
+        if (sink == &text)
+            cout << endl;
+
+        printf("%s\n", reader.error());
         return(1);
     }
 
-    fprintf(annotationfile, "Onset,Annotation\n");
-    int zq = 0;
-    /***************** write data ******************************/
+    return(0);
+}
 
-    ascii_path[pathlen - 4] = 0;
-    strcat(ascii_path, "_data.txt");
-    outputfile = fopen(ascii_path, "wb");
+int main(int argc, char* argv[])
+{
+    FILE* annotationfile = NULL;
+
+    char ascii_path[512];
+
+    const char* path = NULL,
+        * signal_list = NULL,
+        * output_path = NULL,
+        * npy_path = NULL,
+        * npz_path = NULL,
+        * catalog_path = NULL,
+        * query_path = NULL,
+        * channel = NULL,
+        * cache_dir = NULL;
+
+    int i, pathlen,
+        channels = 0,
+        type = 'd',
+        first_record = -1,
+        records = -1,
+        threads = 1,
+        buffers = 0,
+        buffer_size = 4,
+        cache_budget = 4096,
+        queue_depth = 0,
+        block_records = 0,
+        null_output = 0,
+        sidecars = 0,
+        annotations = 0,
+        err;
+
+    double start = -1.0,
+        duration = -1.0,
+        min_rate = 0.0;
+
+    EdfReader reader;
+
+    EdfCache cache;
+
+    setlocale(LC_ALL, "C");
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--matrix"))
+            channels = 1;
+        else if (!strcmp(argv[i], "--float"))
+            type = 'f';
+        else if (!strcmp(argv[i], "--half"))
+            type = 'h';
+        else if (!strcmp(argv[i], "--start") && (i + 1 < argc))
+            start = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--duration") && (i + 1 < argc))
+            duration = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--first-record") && (i + 1 < argc))
+            first_record = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--records") && (i + 1 < argc))
+            records = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--signals") && (i + 1 < argc))
+            signal_list = argv[++i];
+        else if (!strcmp(argv[i], "--threads") && (i + 1 < argc))
+            threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--pipeline") && (i + 1 < argc))
+            buffers = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--buffer-size") && (i + 1 < argc))
+            buffer_size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--io-uring") && (i + 1 < argc))
+            queue_depth = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--output") && (i + 1 < argc))
+            output_path = argv[++i];
+        else if (!strcmp(argv[i], "--npy") && (i + 1 < argc))
+            npy_path = argv[++i];
+        else if (!strcmp(argv[i], "--npz") && (i + 1 < argc))
+            npz_path = argv[++i];
+        else if (!strcmp(argv[i], "--null"))
+            null_output = 1;
+        else if (!strcmp(argv[i], "--block-records") && (i + 1 < argc))
+            block_records = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--annotations"))
+            annotations = 1;
+        else if (!strcmp(argv[i], "--cache") && (i + 1 < argc))
+            cache_dir = argv[++i];
+        else if (!strcmp(argv[i], "--cache-budget") && (i + 1 < argc))
+            cache_budget = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--catalog") && (i + 1 < argc))
+            catalog_path = argv[++i];
+        else if (!strcmp(argv[i], "--query") && (i + 1 < argc))
+            query_path = argv[++i];
+        else if (!strcmp(argv[i], "--channel") && (i + 1 < argc))
+            channel = argv[++i];
+        else if (!strcmp(argv[i], "--min-rate") && (i + 1 < argc))
+            min_rate = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--sidecars"))
+            sidecars = 1;
+        else if ((argv[i][0] != '-') && (path == NULL))
+            path = argv[i];
+        else
+        {
+            path = NULL;
+            break;
+        }
+    }
 
-    if (outputfile == NULL)//проверка открытия
+    if ((path == NULL) && (query_path == NULL))
     {
-        printf("Error, can not open file %s for writing\n", ascii_path);
-        fclose(inputfile);
-        fclose(annotationfile);
-        free(edf_hdr);
-        free(edfparam);
-        free(cnv_buf);
-        free(time_in_txt);
-        free(duration_in_txt);
-        free(scratchpad);
+        printf("\nEDF(+) or BDF(+) to Eigen converter version 0.0.1\n"
+            "Usage: edf2eigen [options] <filename>\n\n"
+            "  --matrix              print a samples x channels matrix instead of a single column\n"
+            "  --float               decode to single precision\n"
+            "  --half                decode to IEEE half precision\n"
+            "  --start <s>           decode from the datarecord containing second s\n"
+            "  --duration <s>        decode the datarecords covering s seconds\n"
+            "  --first-record <n>    decode from datarecord n (counting from 0)\n"
+            "  --records <n>         decode n datarecords\n"
+            "  --signals <list>      decode only these signals, in this order; a comma separated\n"
+            "                        list of signal numbers (counting from 1) or labels\n"
+            "  --threads <n>         decode with n threads, 0 for one per CPU core\n"
+            "  --pipeline <n>        read ahead into n buffers on a separate I/O thread\n"
+            "  --buffer-size <MB>    size of each read-ahead buffer (default 4)\n"
+            "  --io-uring <n>        read ahead with up to n reads in flight (Linux io_uring)\n"
+            "  --output <file>       decode into a memory-mapped matrix file instead of printing\n"
+            "  --npy <file>          write the samples as a NumPy .npy file instead of printing\n"
+            "  --npz <file>          write a NumPy .npz file with one array per channel and the\n"
+            "                        signal headers instead of printing\n"
+            "  --null                decode without writing the samples anywhere\n"
+            "  --block-records <n>   decode and write n datarecords at a time\n"
+            "                        (printed columns are aligned per block)\n"
+            "  --annotations         print only the annotations (onset,duration,text), reading\n"
+            "                        nothing but the annotation signals\n"
+            "  --sidecars            also write the header, the signal headers and the\n"
+            "                        annotations to _header.txt, _signals.txt and _annotations.txt\n"
+            "  --cache <dir>         keep the decoded samples in <dir> and use them the next time\n"
+            "  --cache-budget <MB>   size the cache is kept under (default 4096)\n"
+            "  --catalog <index>     index the headers of all EDF and BDF files below the\n"
+            "                        directory <filename> into the file <index>\n"
+            "  --query <index>       list the files in <index> with a signal --channel <label>\n"
+            "                        sampled at --min-rate <Hz> or more (no <filename>)\n\n");
         return(1);
     }
 
-    // fprintf(outputfile, "Time");
+    if (query_path != NULL)
+        return query_catalog(query_path, channel, min_rate);
 
-    for (i = 0; i < (signals - nr_annot_chns); i++)
-    {
-        //  fprintf(outputfile, ",%i", i + 1); // колличество сигналова 
-    }
+    if (catalog_path != NULL)
+        return build_catalog(catalog_path, path, threads);
 
+    pathlen = strlen(path);
 
-    /*if (fputc('\n', outputfile)==EOF) //Записываем в файл \n, если не можем - exit
-    {
-      printf("Error when writing to outputfile\n");
-      fclose(inputfile);
-      fclose(annotationfile);
-      fclose(outputfile);
-      free(edf_hdr);
-      free(edfparam);
-      free(cnv_buf);
-      free(time_in_txt);
-      free(duration_in_txt);
-      free(scratchpad);
-      return(1);
-    }*/
-
-    if (fseek(inputfile, (signals + 1) * 256, SEEK_SET)) //проверка ренжда 
+    if (pathlen > 480)
     {
-        printf("Error when reading inputfile\n");
-        fclose(inputfile);
-        fclose(annotationfile);
-        fclose(outputfile);
-        free(edf_hdr);
-        free(edfparam);
-        free(cnv_buf);
-        free(time_in_txt);
-        free(duration_in_txt);
-        free(scratchpad);
+        printf("Error, path is too long\n");
         return(1);
     }
 
-    /***************** start data conversion ******************************/
+    strcpy(ascii_path, path);
 
-    datarecordswritten = 0;
+    reader.set_threads(threads);
 
-    for (i = 0; i < datarecords; i++)
+    if (buffers > 0)
     {
-        for (j = 0; j < signals; j++)
-            edfparam[j].smp_written = 0; //обнуляем колличество сигналов в записи
-
-        if (fread(cnv_buf, recordsize * samplesize, 1, inputfile) != 1)
-        {
-            printf("Error when reading inputfile during conversion\n");
-            fclose(inputfile);
-            fclose(annotationfile);
-            fclose(outputfile);
-            free(edf_hdr);
-            free(edfparam);
-            free(cnv_buf);
-            free(time_in_txt);
-            free(duration_in_txt);
-            free(scratchpad);
-            return(1);
-        }
-
-        if (edfplus || bdfplus)
-        {
-            max = edfparam[annot_ch[0]].smp_per_record * samplesize; //количество сигналов в записи данных *  samplesize(число для конкретного формата)
-            p = edfparam[annot_ch[0]].buf_offset * samplesize; //смещение *  samplesize(число для конкретного формата)
-
-      /* extract time from datarecord */
-
-            for (k = 0; k < max; k++)
-            {
-                if (k > max_tal_ln)
-                {
-                    printf("Error, TAL in record %i exceeds my buffer\n", datarecordswritten + 1);
-                    fclose(inputfile);
-                    fclose(annotationfile);
-                    fclose(outputfile);
-                    free(edf_hdr);
-                    free(edfparam);
-                    free(cnv_buf);
-                    free(time_in_txt);
-                    free(duration_in_txt);
-                    free(scratchpad);
-                    return(1);
-                }
-                scratchpad[k] = cnv_buf[p + k]; //В буфер записываем cnv_buf[смещение + k]
-                if (scratchpad[k] == 20)
-                    break;
-            }
-            scratchpad[k] = 0; //зануляем последний символ
-            elapsedtime = atof(scratchpad); //пройденной время
-
-      /* process annotations */
-
-            for (r = 0; r < nr_annot_chns; r++)
-            {
-                //Для каждой аннотации 
-                p = edfparam[annot_ch[r]].buf_offset * samplesize;
-                max = edfparam[annot_ch[r]].smp_per_record * samplesize;
-                n = 0;
-                zero = 0;
-                onset = 0;
-                duration = 0;
-                time_in_txt[0] = 0;
-                duration_in_txt[0] = 0;
-                scratchpad[0] = 0;
-
-                for (k = 0; k < max; k++)
-                {
-                    if (k > max_tal_ln)
-                    {
-                        printf("Error, TAL in record %i exceeds my buffer\n", datarecordswritten + 1); //выхож за рамки
-                        fclose(inputfile);
-                        fclose(annotationfile);
-                        fclose(outputfile);
-                        free(edf_hdr);
-                        free(edfparam);
-                        free(cnv_buf);
-                        free(time_in_txt);
-                        free(duration_in_txt);
-                        free(scratchpad);
-                        return(1);
-                    }
-
-                    //на кадой итерации n увеличивается на 1
-                    scratchpad[n] = cnv_buf[p + k];
-
-                    if (scratchpad[n] == 0)
-                    {
-                        n = 0;
-                        onset = 0;
-                        duration = 0;
-                        time_in_txt[0] = 0;
-                        duration_in_txt[0] = 0;
-                        scratchpad[0] = 0;
-                        zero++;
-                        continue;
-                    }
-                    else
-                        zero = 0;
-
-                    if (zero > 1)
-                        break;
-
-                    if (scratchpad[n] == 20)
-                    {
-                        if (duration)
-                        {
-                            scratchpad[n] = 0;
-                            strcpy(duration_in_txt, scratchpad);
-                            n = 0;
-                            duration = 0;
-                            scratchpad[0] = 0;
-                            continue;
-                        }
-                        else if (onset)
-                        {
-                            scratchpad[n] = 0;
-                            if (n)
-                            {
-                                utf8_to_latin1(scratchpad);
-                                for (m = 0; m < n; m++)
-                                {
-                                    if (scratchpad[m] == 0)
-                                    {
-                                        break;
-                                    }
-
-                                    if ((((unsigned char*)scratchpad)[m] < 32) || (((unsigned char*)scratchpad)[m] == ','))
-                                    {
-                                        scratchpad[m] = '.';
-                                    }
-                                }
-                                fprintf(annotationfile, "%s,%s,%s\n", time_in_txt, duration_in_txt, scratchpad);//время от рождения , длтельность , коментарий 
-                            }
-                            n = 0;
-                            duration = 0;
-                            duration_in_txt[0] = 0;
-                            scratchpad[0] = 0;
-                            continue;
-                        }
-                        else
-                        {
-                            scratchpad[n] = 0;
-                            strcpy(time_in_txt, scratchpad);
-                            n = 0;
-                            onset = 1;
-                            duration = 0;
-                            duration_in_txt[0] = 0;
-                            scratchpad[0] = 0;
-                            continue;
-                        }
-                    }
-
-                    if (scratchpad[n] == 21)
-                    {
-                        if (!onset)
-                        {
-                            scratchpad[n] = 0;
-                            strcpy(time_in_txt, scratchpad);
-                            onset = 1;
-                        }
-                        n = 0;
-                        duration = 1;
-                        duration_in_txt[0] = 0;
-                        scratchpad[0] = 0;
-                        continue;
-                    }
-
-                    if (++n > max_tal_ln)
-                    {
-                        printf("Error, TAL in record %i exceeds my buffer\n", datarecordswritten + 1);
-                        fclose(inputfile);
-                        fclose(annotationfile);
-                        fclose(outputfile);
-                        free(edf_hdr);
-                        free(edfparam);
-                        free(cnv_buf);
-                        free(time_in_txt);
-                        free(duration_in_txt);
-                        free(scratchpad);
-                        return(1);
-                    }
-                }
-            }
-        }
-        else elapsedtime = datarecordswritten * data_record_duration;
-
-        /* done with timekeeping and annotations, continue with the data */
-
-        do
-        {
-            time_tmp = 10000000000.0;
-            for (j = 0; j < signals; j++)
-            {
-                if (edfplus || bdfplus)
-                {
-                    skip = 0;
-
-                    for (p = 0; p < nr_annot_chns; p++)
-                    {
-                        if (j == annot_ch[p])
-                        {
-                            skip = 1;
-                            break;
-                        }
-                    }
-
-                    if (skip)
-                        continue;
-                }
-
-                d_tmp = edfparam[j].smp_written * edfparam[j].time_step; //количество сигналов в записи * промежуток времени
-                if (d_tmp < time_tmp)
-                    time_tmp = d_tmp; //максимальное время
-            }
-            // fprintf(outputfile, "%f", elapsedtime + time_tmp);
-
-            for (j = 0; j < signals; j++) //кол-во сигналов
-            {
-
-                if (edfplus || bdfplus)
-                {
-                    skip = 0;
-
-                    for (p = 0; p < nr_annot_chns; p++)
-                    {
-                        if (j == annot_ch[p])
-                        {
-                            skip = 1;
-                            break;
-                        }
-                    }
-
-                    if (skip) continue;
-                }
-
-                d_tmp = edfparam[j].smp_written * edfparam[j].time_step;
-
-                if ((d_tmp < (time_tmp + 0.00000000000001)) && (d_tmp > (time_tmp - 0.00000000000001)) && (edfparam[j].smp_written < edfparam[j].smp_per_record))
-                {
-                    if (edf)
-                    {
-                        value_tmp = ((*(((signed short*)cnv_buf) + edfparam[j].buf_offset + edfparam[j].smp_written)) + edfparam[j].offset) * edfparam[j].sense;
-                    }
-
-                    if (bdf)
-                    {
-                        var.two[0] = *((unsigned short*)(cnv_buf + ((edfparam[j].buf_offset + edfparam[j].smp_written) * 3)));
-                        var.four[2] = *(cnv_buf + ((edfparam[j].buf_offset + edfparam[j].smp_written) * 3) + 2);
-
-                        if (var.four[2] & 0x80)
-                        {
-                            var.four[3] = 0xff;
-                        }
-                        else
-                        {
-                            var.four[3] = 0x00;
-                        }
-
-                        value_tmp = (var.one_signed + edfparam[j].offset) * edfparam[j].sense;
-                    }
-
-                    // FIXME: Main Here
-                    //fprintf(outputfile, "%f %d 4 * BUF1[] + SF!\r", value_tmp, zq);
-                    val.push_back(value_tmp);
-                    zq += 1;
-                    if (zq == 95020)
-                        return(0);
-                    edfparam[j].smp_written++;
-                }
-                else fputc(',', outputfile);
-            }
-
-            if (fputc('\n', outputfile) == EOF)
-            {
-                printf("Error when writing to outputfile during conversion\n");
-                fclose(inputfile);
-                fclose(annotationfile);
-                fclose(outputfile);
-                free(edf_hdr);
-                free(edfparam);
-                free(cnv_buf);
-                free(time_in_txt);
-                free(duration_in_txt);
-                free(scratchpad);
-                return(1);
-            }
-            recordfull = 1;
+        if (buffer_size < 1)
+            buffer_size = 1;
 
-            for (j = 0; j < signals; j++)
-            {
-                if (edfparam[j].smp_written < edfparam[j].smp_per_record)
-                {
-                    if (edfplus || bdfplus)
-                    {
-                        skip = 0;
-
-                        for (p = 0; p < nr_annot_chns; p++)
-                        {
-                            if (j == annot_ch[p])
-                            {
-                                skip = 1;
-                                break;
-                            }
-                        }
-                        if (skip) continue;
-                    }
-                    recordfull = 0;
-                    break;
-                }
-            }
-        } while (!recordfull);//шото бред, убери
-        datarecordswritten++;
+        reader.set_pipeline(buffers, (size_t)buffer_size << 20);
+        reader.set_io_uring(queue_depth);
     }
-    fclose(inputfile);
-    fclose(annotationfile);
-    fclose(outputfile);
-    free(edf_hdr);
-    free(edfparam);
-    free(cnv_buf);
-    free(time_in_txt);
-    free(duration_in_txt);
-    free(scratchpad);
-
-    return(0);
-}
-
-void utf8_to_latin1(char* utf8_str)
-{
-    int i, j, len;
 
-    unsigned char* str;
+    if (reader.open(path))
+    {
+        printf("%s\n", reader.error());
+        return(1);
+    }
 
+    if ((start >= 0.0) || (duration > 0.0))
+    {
+        if (start < 0.0)
+            start = 0.0;
+        if (duration <= 0.0)
+            duration = reader.datarecords() * reader.data_record_duration() - start;
 
-    str = (unsigned char*)utf8_str;
+        err = reader.set_time_window(start, duration);
+    }
+    else if ((first_record >= 0) || (records > 0))
+    {
+        if (first_record < 0)
+            first_record = 0;
+        if (records <= 0)
+            records = reader.datarecords() - first_record;
 
-    len = strlen(utf8_str);
+        err = reader.set_records(first_record, records);
+    }
+    else err = 0;
 
-    if (!len)
+    if (err)
     {
-        return;
+        printf("%s\n", reader.error());
+        return(1);
     }
 
-    j = 0;
+    if ((signal_list != NULL) && select_signals(reader, signal_list))
+        return(1);
 
-    for (i = 0; i < len; i++)
+    if (sidecars)
     {
-        if ((str[i] < 32) || ((str[i] > 127) && (str[i] < 192)))
-        {
-            str[j++] = '.';
-
-            continue;
-        }
+        if (write_header(reader, ascii_path, pathlen))
+            return(1);
 
-        if (str[i] > 223)
-        {
-            str[j++] = 0;
+        if ((annotationfile = open_sidecar(ascii_path, pathlen, "_annotations.txt")) == NULL)
+            return(1);
 
-            return;  /* can only decode Latin-1 ! */
-        }
+        fprintf(annotationfile, "Onset,Annotation\n");
+        reader.set_annotation_output(annotationfile);
+    }
 
-        if ((str[i] & 224) == 192)  /* found a two-byte sequence containing Latin-1, Greek, Cyrillic, Coptic, Armenian, Hebrew, etc. characters */
+    if (cache_dir != NULL)
+    {
+        if (cache.set_dir(cache_dir))
         {
-            if ((i + 1) == len)
-            {
-                str[j++] = 0;
-
-                return;
-            }
-
-            if ((str[i] & 252) != 192) /* it's not a Latin-1 character */
-            {
-                str[j++] = '.';
-
-                i++;
-
-                continue;
-            }
-
-            if ((str[i + 1] & 192) != 128) /* UTF-8 violation error */
-            {
-                str[j++] = 0;
-
-                return;
-            }
-
-            str[j] = str[i] << 6;
-            str[j] += (str[i + 1] & 63);
-
-            i++;
-            j++;
-
-            continue;
+            printf("%s\n", cache.error());
+            return(1);
         }
 
-        str[j++] = str[i];
+        cache.set_budget((long long)cache_budget << 20);
     }
 
-    if (j < len)
-    {
-        str[j] = 0;
-    }
-}
+    if (annotations)
+        err = print_annotations(reader);
+    else if (type == 'f')
+        err = decode<float>(reader, channels, block_records, null_output, output_path, npy_path, npz_path, cache_dir != NULL ? &cache : NULL, path);
+    else if (type == 'h')
+        err = decode<Eigen::half>(reader, channels, block_records, null_output, output_path, npy_path, npz_path, cache_dir != NULL ? &cache : NULL, path);
+    else
+        err = decode<double>(reader, channels, block_records, null_output, output_path, npy_path, npz_path, cache_dir != NULL ? &cache : NULL, path);
 
-MatrixXd vector2eigen(vector<double> v) {
-    MatrixXd ans(v.size(), 1);
-    for (int i = 0; i < v.size(); i++) {
-        ans(i, 0) = v[i];
-    }
-    return ans;
-}
\ No newline at end of file
+    if (annotationfile != NULL)
+        fclose(annotationfile);
+
+    return err;
+}
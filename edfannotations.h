@@ -0,0 +1,165 @@
+/*
+***************************************************************************
+*
+* Author: LetMeFly Tisfy & Teunis van Beelen
+*
+* Copyright (C) 2022 LetMeFly Tisfy & Teunis van Beelen
+*
+* Tisfy@foxmail.com & teuniz@gmail.com
+*
+***************************************************************************
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation version 2 of the License.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*
+***************************************************************************
+*
+* This version of GPL is at https://www.gnu.org/licenses/gpl-3.0.txt
+*
+***************************************************************************
+*/
+
+/*
+ * EdfAnnotations: the EDF+ annotations of a selection, parsed once.
+ *
+ * Every annotation is an edfannotation; their texts sit one after another,
+ * NUL-terminated, in a single arena, so a file with many thousands of
+ * events takes two allocations that grow by doubling. The list is ordered
+ * by onset, which lets find() pick out a time range by binary search:
+ *
+ *     std::pair<int, int> r = reader.annotations().find(60.0, 120.0);
+ *     for (int i = r.first; i < r.second; i++)
+ *         printf("%f %s\n", reader.annotations()[i].onset, reader.annotations().text(i));
+ */
+
+#ifndef EDFANNOTATIONS_H
+#define EDFANNOTATIONS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+struct edfannotation
+{
+    double onset,       /* seconds from the start of the recording */
+        duration;       /* seconds, -1 when the TAL gives none */
+    int text,           /* offset of the text in the arena */
+        length;         /* bytes of UTF-8 text */
+    int record;         /* datarecord that holds the annotation */
+    long long sample;   /* sample nearest to the onset at the samplerate of the first */
+                        /* column, counting from the first datarecord of the file     */
+};
+
+class EdfAnnotations
+{
+public:
+    int size() const { return (int)list.size(); }
+    bool empty() const { return list.empty(); }
+    const edfannotation& operator[](int i) const { return list[i]; }
+    std::vector<edfannotation>::const_iterator begin() const { return list.begin(); }
+    std::vector<edfannotation>::const_iterator end() const { return list.end(); }
+
+    /* the UTF-8 text of annotation i, NUL-terminated */
+    const char* text(int i) const { return arena.data() + list[i].text; }
+
+    /* [first, second) are the annotations with from <= onset < to */
+    std::pair<int, int> find(double from, double to) const;
+
+    void clear() { list.clear(); arena.clear(); sorted = true; }
+    void add(double onset, double duration, const char* text, int length, int record, long long sample);
+    /* orders by onset, annotations with the same onset in the order they were added */
+    void sort();
+
+private:
+    std::vector<edfannotation> list;
+    std::vector<char> arena;
+
+    bool sorted = true;
+};
+
+inline void EdfAnnotations::add(double onset, double duration, const char* s, int length, int record, long long sample)
+{
+    edfannotation a;
+
+    a.onset = onset;
+    a.duration = duration;
+    a.text = (int)arena.size();
+    a.length = length;
+    a.record = record;
+    a.sample = sample;
+
+    if (!list.empty() && (onset < list.back().onset))
+        sorted = false;
+
+    list.push_back(a);
+    arena.insert(arena.end(), s, s + length);
+    arena.push_back(0);
+}
+
+inline void EdfAnnotations::sort()
+{
+    if (sorted)
+        return;
+
+    std::stable_sort(list.begin(), list.end(), [](const edfannotation& a, const edfannotation& b)
+    {
+        return a.onset < b.onset;
+    });
+
+    sorted = true;
+}
+
+inline std::pair<int, int> EdfAnnotations::find(double from, double to) const
+{
+    std::vector<edfannotation>::const_iterator first, last;
+
+    first = std::lower_bound(list.begin(), list.end(), from, [](const edfannotation& a, double t) { return a.onset < t; });
+    last = std::lower_bound(first, list.end(), to, [](const edfannotation& a, double t) { return a.onset < t; });
+
+    return std::make_pair((int)(first - list.begin()), (int)(last - list.begin()));
+}
+
+/* The TAL parser looks for its delimiters with memchr(), which the C library */
+/* runs over 16 or 32 bytes at a time, instead of testing every byte.         */
+
+/* the first 0x14 or 0x15 in [s, end), end if there is none */
+inline const char* edf_tal_delimiter(const char* s, const char* end)
+{
+    const char* d = (const char*)memchr(s, 20, end - s);
+
+    if (d == NULL)
+        d = end;
+
+    const char* u = (const char*)memchr(s, 21, d - s);
+
+    return (u != NULL) ? u : d;
+}
+
+/* the first byte in [s, end) that is not 0, end if there is none; the */
+/* unused part of an annotation signal is all zeros                    */
+inline const char* edf_skip_zeros(const char* s, const char* end)
+{
+    uint64_t w;
+
+    while ((end - s >= 8) && (memcpy(&w, s, 8), w == 0))
+        s += 8;
+
+    while ((s < end) && (*s == 0))
+        s++;
+
+    return s;
+}
+
+#endif
@@ -0,0 +1,491 @@
+/*
+***************************************************************************
+*
+* Author: LetMeFly Tisfy & Teunis van Beelen
+*
+* Copyright (C) 2022 LetMeFly Tisfy & Teunis van Beelen
+*
+* Tisfy@foxmail.com & teuniz@gmail.com
+*
+***************************************************************************
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation version 2 of the License.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*
+***************************************************************************
+*
+* This version of GPL is at https://www.gnu.org/licenses/gpl-3.0.txt
+*
+***************************************************************************
+*/
+
+/*
+ * EdfCache: decoded matrices kept on disk, so that opening the same
+ * recording again is one mmap() instead of a decode.
+ *
+ * An entry is an EdfMatrixFile named after a 64-bit hash of what went into
+ * it: the real path of the recording, its size and modification time, its
+ * header, and the selection (datarecords, signals, element type, layout).
+ * A recording that changes gets a new key, and its old entries age out.
+ *
+ *     EdfCache cache;
+ *     EdfMatrixFile m;
+ *     if (cache.set_dir("/var/cache/edf") || cache.read<float>(path, reader, true, m))
+ *         ...
+ *     use(m.map<float>());
+ *
+ * The entries in the directory together stay under a byte budget: before a
+ * new one is added the least recently used ones are removed, by the time
+ * they were last read (every hit touches the file). A matrix larger than
+ * the whole budget is decoded into a file that is unlinked while mapped.
+ *
+ * Several processes, and threads with an EdfCache each, can share one
+ * directory. An entry is decoded under a temporary name of its own (process
+ * id and a per-process counter) and renamed into place when it is complete,
+ * so a reader never sees half an entry, two decodes of the same entry do not
+ * write into one file, and a mapping stays valid when another process
+ * removes its file. Eviction and renaming run under flock() on the file
+ * "lock" in the directory.
+ *
+ * A hit does not read the datarecords at all; if the reader has an
+ * annotation output or store set, its annotations are read on their own
+ * (see EdfReader::read_annotations()).
+ *
+ * Like EdfReader, methods return 1 on failure and error() says why.
+ */
+
+#ifndef EDFCACHE_H
+#define EDFCACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "edfmatrix.h"
+#include "edfreader.h"
+#ifdef EDF_HAVE_MATRIX_FILE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__APPLE__)
+#define EDF_ST_MTIM(st) ((st).st_mtimespec)
+#else
+#define EDF_ST_MTIM(st) ((st).st_mtim)
+#endif
+#endif
+
+/* 64-bit FNV-1a of len bytes, continuing from h */
+inline uint64_t edf_fnv1a(const void* p, size_t len, uint64_t h = 0xcbf29ce484222325ULL)
+{
+    const unsigned char* s = (const unsigned char*)p;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= s[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+/* a number no other call in this process gets, for temporary file names */
+inline unsigned edf_cache_serial()
+{
+    static std::atomic<unsigned> n(0);
+
+    return n++;
+}
+
+class EdfCache
+{
+public:
+    /* the directory of the entries, made if it does not exist */
+    int set_dir(const char* dir);
+    /* bytes all entries together may take (default 4 GB) */
+    void set_budget(long long bytes) { budget = bytes; }
+    long long get_budget() const { return budget; }
+
+    /* The selection of reader, which has path open, as a matrix: from the */
+    /* cache if it is there, else decoded into the cache. channels as with */
+    /* read_channels(), otherwise one column as read() gives it.           */
+    template<typename Scalar>
+    int read(const char* path, EdfReader& reader, bool channels, EdfMatrixFile& out);
+    /* the same, handed to a sink in one block */
+    template<typename Scalar>
+    int read(const char* path, EdfReader& reader, bool channels, EdfSink<Scalar>& sink);
+
+    /* whether the last read() came from the cache */
+    bool hit() const { return last_hit; }
+
+    /* removes the least recently used entries until at most keep bytes are left */
+    int evict(long long keep);
+
+    const char* error() const { return errmsg; }
+
+private:
+    int fail(const char* fmt, ...);
+    int entry_name(const char* path, EdfReader& reader, bool channels, int dtype, std::string& name);
+    int lock();
+    void unlock();
+    int evict_locked(long long keep);
+
+    std::string dir;
+
+    long long budget = 4LL << 30;
+
+    int lock_fd = -1;
+
+    bool last_hit = false;
+
+    char errmsg[512] = "";
+};
+
+inline int EdfCache::fail(const char* fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(errmsg, sizeof(errmsg), fmt, args);
+    va_end(args);
+
+    return(1);
+}
+
+inline int EdfCache::set_dir(const char* d)
+{
+#ifdef EDF_HAVE_MATRIX_FILE
+    struct stat st;
+
+    if ((mkdir(d, 0755) != 0) && ((stat(d, &st) != 0) || !S_ISDIR(st.st_mode)))
+    {
+        return fail("Error, can not make cache directory %s", d);
+    }
+
+    dir = d;
+    if (dir.empty() || (dir.back() != '/'))
+        dir += '/';
+
+    return(0);
+#else
+    (void)d;
+
+    return fail("Error, the decoded-data cache is not supported on this platform");
+#endif
+}
+
+/* the file name of the entry for what reader would decode now */
+inline int EdfCache::entry_name(const char* path, EdfReader& reader, bool channels, int dtype, std::string& name)
+{
+#ifdef EDF_HAVE_MATRIX_FILE
+    struct stat st;
+
+    char real[PATH_MAX],
+        hex[32];
+
+    int32_t sel[6];
+
+    long long t[2];
+
+    uint64_t h;
+
+    int c;
+
+    if ((realpath(path, real) == NULL) || stat(real, &st))
+    {
+        return fail("Error, can not find file %s", path);
+    }
+
+    /* the identity of the file ... */
+    h = edf_fnv1a(real, strlen(real) + 1);
+    h = edf_fnv1a(&st.st_size, sizeof(st.st_size), h);
+    t[0] = EDF_ST_MTIM(st).tv_sec;
+    t[1] = EDF_ST_MTIM(st).tv_nsec;
+    h = edf_fnv1a(t, sizeof(t), h);
+    h = edf_fnv1a(reader.header(), (size_t)(reader.signals() + 1) * 256, h);
+
+    /* ... and of the selection */
+    sel[0] = 1;     /* layout of the key, changes with it */
+    sel[1] = reader.first_record();
+    sel[2] = reader.record_count();
+    sel[3] = channels;
+    sel[4] = dtype;
+    sel[5] = reader.columns();
+    h = edf_fnv1a(sel, sizeof(sel), h);
+
+    for (c = 0; c < reader.columns(); c++)
+    {
+        sel[0] = reader.column_signal(c);
+        h = edf_fnv1a(sel, sizeof(sel[0]), h);
+    }
+
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)h);
+
+    name = dir + hex + ".edfm";
+
+    return(0);
+#else
+    (void)path; (void)reader; (void)channels; (void)dtype; (void)name;
+
+    return fail("Error, the decoded-data cache is not supported on this platform");
+#endif
+}
+
+inline int EdfCache::lock()
+{
+#ifdef EDF_HAVE_MATRIX_FILE
+    lock_fd = ::open((dir + "lock").c_str(), O_RDWR | O_CREAT, 0644);
+    if (lock_fd < 0)
+    {
+        return fail("Error, can not open %slock", dir.c_str());
+    }
+
+    while (flock(lock_fd, LOCK_EX))
+    {
+        if (errno != EINTR)
+        {
+            unlock();
+            return fail("Error, can not lock %slock", dir.c_str());
+        }
+    }
+#endif
+
+    return(0);
+}
+
+inline void EdfCache::unlock()
+{
+#ifdef EDF_HAVE_MATRIX_FILE
+    if (lock_fd >= 0)
+        ::close(lock_fd);
+#endif
+
+    lock_fd = -1;
+}
+
+inline int EdfCache::evict(long long keep)
+{
+    int err;
+
+    if (dir.empty())
+    {
+        return fail("Error, no cache directory set");
+    }
+
+    if (lock())
+        return(1);
+
+    err = evict_locked(keep);
+
+    unlock();
+
+    return err;
+}
+
+/* With the lock held: drops entries, least recently used first, until the */
+/* rest take at most keep bytes. Temporary files of decodes that died a    */
+/* day or more ago go as well.                                             */
+inline int EdfCache::evict_locked(long long keep)
+{
+#ifdef EDF_HAVE_MATRIX_FILE
+    struct entry
+    {
+        std::string path;
+        long long bytes;
+        struct timespec used;
+    };
+
+    std::vector<entry> entries;
+
+    DIR* d;
+
+    struct dirent* e;
+
+    struct stat st;
+
+    std::string p;
+
+    long long total = 0;
+
+    size_t i, len;
+
+    d = opendir(dir.c_str());
+    if (d == NULL)
+    {
+        return fail("Error, can not read cache directory %s", dir.c_str());
+    }
+
+    while ((e = readdir(d)) != NULL)
+    {
+        len = strlen(e->d_name);
+        p = dir + e->d_name;
+
+        if ((len > 4) && !strcmp(e->d_name + len - 4, ".tmp"))
+        {
+            if (!stat(p.c_str(), &st) && (st.st_mtime + 86400 < time(NULL)))
+                unlink(p.c_str());
+            continue;
+        }
+
+        if ((len <= 5) || strcmp(e->d_name + len - 5, ".edfm") || stat(p.c_str(), &st))
+            continue;
+
+        entries.push_back({ p, (long long)st.st_size, EDF_ST_MTIM(st) });
+        total += st.st_size;
+    }
+
+    closedir(d);
+
+    std::sort(entries.begin(), entries.end(), [](const entry& a, const entry& b)
+    {
+        return (a.used.tv_sec != b.used.tv_sec) ? a.used.tv_sec < b.used.tv_sec : a.used.tv_nsec < b.used.tv_nsec;
+    });
+
+    for (i = 0; (i < entries.size()) && (total > keep); i++)
+    {
+        if (!unlink(entries[i].path.c_str()))
+            total -= entries[i].bytes;
+    }
+#else
+    (void)keep;
+#endif
+
+    return(0);
+}
+
+template<typename Scalar>
+int EdfCache::read(const char* path, EdfReader& reader, bool channels, EdfMatrixFile& out)
+{
+    const int dtype = edf_matrix_dtype<Scalar>::value;
+
+    std::string name, tmp;
+
+    char suffix[64];
+
+    long long bytes;
+
+    int err;
+
+    last_hit = false;
+
+#ifdef EDF_HAVE_MATRIX_FILE
+    if (dir.empty())
+    {
+        return fail("Error, no cache directory set");
+    }
+
+    if (entry_name(path, reader, channels, dtype, name))
+        return(1);
+
+    /* a hit: map it and mark it used */
+    if (!out.open(name.c_str()) && (out.dtype() == dtype))
+    {
+        utimensat(AT_FDCWD, name.c_str(), NULL, 0);
+        last_hit = true;
+
+        if (((reader.annotation_output() != NULL) || reader.annotation_store()) && reader.read_annotations())
+        {
+            out.close();
+            return fail("%s", reader.error());
+        }
+
+        return(0);
+    }
+
+    out.close();
+
+    /* a miss: decode under a name of this process and call, then move it into place */
+    snprintf(suffix, sizeof(suffix), ".%ld.%u.tmp", (long)getpid(), edf_cache_serial());
+
+    tmp = name + suffix;
+
+    {
+        EdfMatrixFileSink<Scalar> sink(tmp.c_str());
+
+        if (channels ? reader.read_channels(sink) : reader.read(sink))
+        {
+            unlink(tmp.c_str());
+            return fail("%s", reader.error());
+        }
+
+        bytes = 4096 + sink.file.rows() * sink.file.cols() * EdfMatrixFile::element_size(dtype);
+    }
+
+    if (lock())
+    {
+        unlink(tmp.c_str());
+        return(1);
+    }
+
+    if (bytes > budget)
+    {
+        /* too large to keep: hand it out and let it go when it is unmapped */
+        err = out.open(tmp.c_str()) ? fail("%s", out.error()) : 0;
+        unlink(tmp.c_str());
+    }
+    else
+    {
+        err = evict_locked(budget - bytes);
+        if (!err && rename(tmp.c_str(), name.c_str()))
+            err = fail("Error, can not rename %s", tmp.c_str());
+        if (err)
+            unlink(tmp.c_str());
+        else if (out.open(name.c_str()))
+            err = fail("%s", out.error());
+    }
+
+    unlock();
+
+    return err;
+#else
+    (void)path; (void)dtype; (void)reader; (void)channels; (void)out; (void)name; (void)tmp; (void)suffix; (void)bytes; (void)err;
+
+    return fail("Error, the decoded-data cache is not supported on this platform");
+#endif
+}
+
+template<typename Scalar>
+int EdfCache::read(const char* path, EdfReader& reader, bool channels, EdfSink<Scalar>& sink)
+{
+    EdfMatrixFile m;
+
+    if (read<Scalar>(path, reader, channels, m))
+        return(1);
+
+    if (sink.begin(m.rows(), m.cols()))
+    {
+        return fail("%s", sink.error());
+    }
+
+    typename EdfSink<Scalar>::block_type block = sink.block(0, m.rows(), m.cols());
+
+    block = m.map<Scalar>();
+
+    if (sink.write(block, 0) || sink.end())
+    {
+        return fail("%s", sink.error());
+    }
+
+    return(0);
+}
+
+#endif
@@ -0,0 +1,595 @@
+/*
+***************************************************************************
+*
+* Author: LetMeFly Tisfy & Teunis van Beelen
+*
+* Copyright (C) 2022 LetMeFly Tisfy & Teunis van Beelen
+*
+* Tisfy@foxmail.com & teuniz@gmail.com
+*
+***************************************************************************
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation version 2 of the License.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*
+***************************************************************************
+*
+* This version of GPL is at https://www.gnu.org/licenses/gpl-3.0.txt
+*
+***************************************************************************
+*/
+
+/*
+ * EdfCatalog: the headers of a whole archive of EDF(+) and BDF(+) files in
+ * one small index, to find recordings without opening them.
+ *
+ * build() reads only the (signals + 1) * 256 header bytes of every .edf and
+ * .bdf file below a directory, with several threads, and parses the fields
+ * in place with edf_field_int() and edf_field_double(). For every file the
+ * index keeps the path, the patient and recording fields, the start time,
+ * the number and duration of the datarecords, and per signal its label,
+ * units, samplerate and physical and digital range. Strings are stored once
+ * in a string table, so thousands of files with the same montage add little
+ * more than their paths.
+ *
+ * save() writes the tables as they are in memory after a 64-byte header
+ * (see edfcatalogheader), in the byte order of the machine; load() reads
+ * them back in one go.
+ *
+ *     EdfCatalog cat;
+ *     if (cat.build("/data/eeg", 0) || cat.save("eeg.edfc"))
+ *         fprintf(stderr, "%s\n", cat.error());
+ *     ...
+ *     for (int f : cat.find("C3", 500.0))
+ *         printf("%s\n", cat.path(f));
+ *
+ * Like EdfReader, methods return 1 on failure and error() says why.
+ */
+
+#ifndef EDFCATALOG_H
+#define EDFCATALOG_H
+
+#include <atomic>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "edfreader.h"
+
+struct edfcatalogheader
+{
+    char magic[8];          /* "EDFCATLG" */
+    uint32_t version;       /* 1 */
+    uint32_t byte_order;    /* 0x01020304 as written */
+    uint64_t files,
+        signals,
+        strings;            /* bytes in the string table */
+    char pad[24];
+};
+
+static_assert(sizeof(edfcatalogheader) == 64, "edfcatalogheader must be 64 bytes");
+
+/* the strings are offsets in the string table */
+struct edfcatalogfile
+{
+    uint32_t path,
+        patient,
+        recording;
+    int32_t datarecords;
+    int64_t start;          /* seconds since 1970-01-01 00:00:00, local time of the recording */
+    double record_duration;
+    uint32_t first_signal,  /* index of its first signal in signal() */
+        signals;
+    uint8_t bdf,            /* 1 for BDF, 0 for EDF */
+        plus,               /* 1 for EDF+ or BDF+ */
+        discontinuous;      /* 1 for EDF+D or BDF+D */
+    uint8_t pad[5];
+};
+
+static_assert(sizeof(edfcatalogfile) == 48, "edfcatalogfile must be 48 bytes");
+
+struct edfcatalogsignal
+{
+    uint32_t label,
+        units;
+    int32_t smp_per_record,
+        dig_min,
+        dig_max;
+    uint32_t annotation;    /* 1 for an annotation signal */
+    double samplerate,      /* Hz, 0 when the datarecords have no duration */
+        phys_min,
+        phys_max;
+};
+
+static_assert(sizeof(edfcatalogsignal) == 48, "edfcatalogsignal must be 48 bytes");
+
+class EdfCatalog
+{
+public:
+    /* indexes every .edf and .bdf file below dir with n threads (0: one per */
+    /* CPU core); files that are not valid EDF or BDF are counted in skipped() */
+    int build(const char* dir, int threads);
+    int save(const char* path);
+    int load(const char* path);
+    void clear();
+
+    int files() const { return (int)filelist.size(); }
+    int skipped() const { return nskipped; }
+    const edfcatalogfile& file(int i) const { return filelist[i]; }
+    const edfcatalogsignal& signal(int i) const { return signallist[i]; }
+    /* the NUL-terminated string at offset in the string table */
+    const char* text(uint32_t offset) const { return strings.data() + offset; }
+    const char* path(int i) const { return text(filelist[i].path); }
+
+    /* the files that have a signal labelled label (trailing spaces ignored, */
+    /* NULL or "" for any) with a samplerate of at least min_rate Hz          */
+    std::vector<int> find(const char* label, double min_rate) const;
+    /* that signal of file i, -1 if it has none */
+    int find_signal(int i, const char* label, double min_rate) const;
+
+    const char* error() const { return errmsg; }
+
+private:
+    /* what one worker makes of the header of one file */
+    struct parsed
+    {
+        bool named = false,     /* the name ends in .edf or .bdf */
+            ok = false;
+        edfcatalogfile file = {};
+        std::string patient,
+            recording;
+        std::vector<edfcatalogsignal> sigs;
+        std::vector<std::string> labels,
+            units;
+    };
+
+    int fail(const char* fmt, ...);
+    static bool parse_header(const char* path, std::vector<char>& hdr, parsed& out);
+    uint32_t add_string(const char* s, size_t len);
+
+    std::vector<edfcatalogfile> filelist;
+    std::vector<edfcatalogsignal> signallist;
+    std::vector<char> strings;
+
+    /* string table offset of every string, while building */
+    std::unordered_map<std::string, uint32_t> string_index;
+
+    int nskipped = 0;
+
+    char errmsg[512] = "";
+};
+
+inline int EdfCatalog::fail(const char* fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(errmsg, sizeof(errmsg), fmt, args);
+    va_end(args);
+
+    return(1);
+}
+
+inline void EdfCatalog::clear()
+{
+    filelist.clear();
+    signallist.clear();
+    strings.clear();
+    string_index.clear();
+    nskipped = 0;
+}
+
+inline uint32_t EdfCatalog::add_string(const char* s, size_t len)
+{
+    uint32_t offset = (uint32_t)strings.size();
+
+    auto it = string_index.emplace(std::string(s, len), offset);
+    if (!it.second)
+        return it.first->second;
+
+    strings.insert(strings.end(), s, s + len);
+    strings.push_back(0);
+
+    return offset;
+}
+
+/* the length of a header field without its trailing spaces */
+inline int edf_field_len(const char* s, int len)
+{
+    while ((len > 0) && (s[len - 1] == ' '))
+        len--;
+
+    return len;
+}
+
+/* days from 1970-01-01 to a date of the proleptic Gregorian calendar */
+inline long long edf_days_from_civil(int y, int m, int d)
+{
+    y -= m <= 2;
+
+    long long era = (y >= 0 ? y : y - 399) / 400;
+    long long yoe = y - era * 400;
+    long long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    long long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
+
+/* Reads and checks the header of one file, the same checks open() makes. */
+/* hdr is the buffer of the calling worker, reused from file to file.     */
+inline bool EdfCatalog::parse_header(const char* path, std::vector<char>& hdr, parsed& out)
+{
+    FILE* f;
+
+    const char* h;
+
+    int i, ns, year, smp, len = strlen(path);
+
+    bool edf, bdf, ok;
+
+    if (len < 5)
+        return false;
+
+    edf = !strcmp(path + len - 4, ".edf") || !strcmp(path + len - 4, ".EDF");
+    bdf = !strcmp(path + len - 4, ".bdf") || !strcmp(path + len - 4, ".BDF");
+    if (!edf && !bdf)
+        return false;
+
+    out.named = true;
+
+    f = fopen(path, "rb");
+    if (f == NULL)
+        return false;
+
+    if (hdr.size() < 256)
+        hdr.resize(256);
+
+    ok = fread(hdr.data(), 256, 1, f) == 1;
+    ns = ok ? edf_field_int(hdr.data() + 0xfc, 4) : 0;
+    ok = ok && (ns >= 1);
+
+    if (ok)
+    {
+        if (hdr.size() < (size_t)(ns + 1) * 256)
+            hdr.resize((size_t)(ns + 1) * 256);
+
+        ok = fread(hdr.data() + 256, (size_t)ns * 256, 1, f) == 1;
+    }
+
+    fclose(f);
+
+    if (!ok)
+        return false;
+
+    h = hdr.data();
+
+    if (edf && strncmp(h, "0       ", 8))
+        return false;
+
+    if (bdf && (strncmp(h + 1, "BIOSEMI", 7) || (h[0] != -1)))
+        return false;
+
+    edfcatalogfile& cf = out.file;
+
+    cf.datarecords = edf_field_int(h + 0xec, 8);
+    if (cf.datarecords < 1)
+        return false;
+
+    cf.record_duration = edf_field_double(h + 0xf4, 8);
+    cf.signals = ns;
+    cf.bdf = bdf;
+    cf.plus = !strncmp(h + 0xc0, edf ? "EDF+C     " : "BDF+C     ", 10) || !strncmp(h + 0xc0, edf ? "EDF+D     " : "BDF+D     ", 10);
+    cf.discontinuous = cf.plus && (h[0xc4] == 'D');
+
+    /* dd.mm.yy hh.mm.ss, years 85 to 99 are 1985 to 1999 */
+    year = edf_field_int(h + 0xae, 2);
+    cf.start = (edf_days_from_civil(year + (year < 85 ? 2000 : 1900), edf_field_int(h + 0xab, 2), edf_field_int(h + 0xa8, 2)) * 24
+        + edf_field_int(h + 0xb0, 2)) * 3600 + edf_field_int(h + 0xb3, 2) * 60 + edf_field_int(h + 0xb6, 2);
+
+    out.patient.assign(h + 8, edf_field_len(h + 8, 80));
+    out.recording.assign(h + 88, edf_field_len(h + 88, 80));
+
+    out.sigs.resize(ns);
+    out.labels.resize(ns);
+    out.units.resize(ns);
+
+    for (i = 0; i < ns; i++)
+    {
+        edfcatalogsignal& s = out.sigs[i];
+
+        s = {};
+
+        smp = edf_field_int(h + 256 + ns * 216 + i * 8, 8);
+        if (smp < 0)
+            return false;
+
+        s.smp_per_record = smp;
+        s.samplerate = cf.record_duration > 0.0 ? smp / cf.record_duration : 0.0;
+        s.phys_min = edf_field_double(h + 256 + ns * 104 + i * 8, 8);
+        s.phys_max = edf_field_double(h + 256 + ns * 112 + i * 8, 8);
+        s.dig_min = edf_field_int(h + 256 + ns * 120 + i * 8, 8);
+        s.dig_max = edf_field_int(h + 256 + ns * 128 + i * 8, 8);
+        s.annotation = cf.plus && !strncmp(h + 256 + i * 16, edf ? "EDF Annotations " : "BDF Annotations ", 16);
+
+        out.labels[i].assign(h + 256 + i * 16, edf_field_len(h + 256 + i * 16, 16));
+        out.units[i].assign(h + 256 + ns * 96 + i * 8, edf_field_len(h + 256 + ns * 96 + i * 8, 8));
+    }
+
+    out.ok = true;
+
+    return true;
+}
+
+inline int EdfCatalog::build(const char* dir, int threads)
+{
+    std::vector<std::string> paths;
+
+    std::vector<parsed> results;
+
+    std::vector<std::thread> workers;
+
+    std::atomic<size_t> next(0);
+
+    std::error_code ec;
+
+    size_t i;
+
+    int t, j;
+
+    clear();
+
+    /* the walk itself is cheap next to opening every file */
+    for (std::filesystem::recursive_directory_iterator it(dir, std::filesystem::directory_options::skip_permission_denied, ec), end;
+        !ec && (it != end); it.increment(ec))
+    {
+        if (it->is_regular_file(ec))
+            paths.push_back(it->path().string());
+    }
+
+    if (ec)
+    {
+        return fail("Error, can not read directory %s: %s", dir, ec.message().c_str());
+    }
+
+    /* the same order on every run, whatever order the directories list in */
+    std::sort(paths.begin(), paths.end());
+
+    results.resize(paths.size());
+
+    if (threads <= 0)
+        threads = (int)std::thread::hardware_concurrency();
+    if (threads < 1)
+        threads = 1;
+    if ((size_t)threads > paths.size())
+        threads = paths.size() > 0 ? (int)paths.size() : 1;
+
+    auto work = [&]()
+    {
+        std::vector<char> hdr;
+
+        size_t k;
+
+        while ((k = next.fetch_add(1)) < paths.size())
+            parse_header(paths[k].c_str(), hdr, results[k]);
+    };
+
+    for (t = 1; t < threads; t++)
+        workers.emplace_back(work);
+
+    work();
+
+    for (t = 0; t < (int)workers.size(); t++)
+        workers[t].join();
+
+    /* one thread puts the tables together, in path order */
+    for (i = 0; i < paths.size(); i++)
+    {
+        parsed& p = results[i];
+
+        if (!p.ok)
+        {
+            nskipped += p.named;
+            continue;
+        }
+
+        p.file.path = add_string(paths[i].data(), paths[i].size());
+        p.file.patient = add_string(p.patient.data(), p.patient.size());
+        p.file.recording = add_string(p.recording.data(), p.recording.size());
+        p.file.first_signal = signallist.size();
+
+        for (j = 0; j < (int)p.sigs.size(); j++)
+        {
+            p.sigs[j].label = add_string(p.labels[j].data(), p.labels[j].size());
+            p.sigs[j].units = add_string(p.units[j].data(), p.units[j].size());
+            signallist.push_back(p.sigs[j]);
+        }
+
+        filelist.push_back(p.file);
+
+        p = parsed();
+    }
+
+    string_index.clear();
+
+    return(0);
+}
+
+inline int EdfCatalog::save(const char* path)
+{
+    edfcatalogheader hdr = {};
+
+    FILE* f;
+
+    bool ok;
+
+    memcpy(hdr.magic, "EDFCATLG", 8);
+    hdr.version = 1;
+    hdr.byte_order = 0x01020304;
+    hdr.files = filelist.size();
+    hdr.signals = signallist.size();
+    hdr.strings = strings.size();
+
+    f = fopen(path, "wb");
+    if (f == NULL)
+    {
+        return fail("Error, can not open file %s for writing", path);
+    }
+
+    ok = (fwrite(&hdr, sizeof(hdr), 1, f) == 1)
+        && (fwrite(filelist.data(), sizeof(edfcatalogfile), filelist.size(), f) == filelist.size())
+        && (fwrite(signallist.data(), sizeof(edfcatalogsignal), signallist.size(), f) == signallist.size())
+        && (fwrite(strings.data(), 1, strings.size(), f) == strings.size());
+
+    if ((fclose(f) != 0) || !ok)
+    {
+        return fail("Error when writing to file %s", path);
+    }
+
+    return(0);
+}
+
+inline int EdfCatalog::load(const char* path)
+{
+    edfcatalogheader hdr;
+
+    struct stat st;
+
+    FILE* f;
+
+    bool ok;
+
+    uint64_t i, rest;
+
+    clear();
+
+    f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        return fail("Error, can not open file %s for reading", path);
+    }
+
+    if ((fread(&hdr, sizeof(hdr), 1, f) != 1) || memcmp(hdr.magic, "EDFCATLG", 8) || (hdr.version != 1))
+    {
+        fclose(f);
+        return fail("Error, %s is not a catalog", path);
+    }
+
+    if (hdr.byte_order != 0x01020304)
+    {
+        fclose(f);
+        return fail("Error, catalog %s was written on a machine with another byte order", path);
+    }
+
+    /* the tables must fit in the file before anything is allocated for them; */
+    /* the counts are divided, not multiplied, so that they can not overflow  */
+    if (fstat(fileno(f), &st) || ((uint64_t)st.st_size < sizeof(hdr)))
+    {
+        fclose(f);
+        return fail("Error, can not read file %s", path);
+    }
+
+    rest = (uint64_t)st.st_size - sizeof(hdr);
+
+    ok = (hdr.files <= rest / sizeof(edfcatalogfile));
+    if (ok)
+    {
+        rest -= hdr.files * sizeof(edfcatalogfile);
+        ok = (hdr.signals <= rest / sizeof(edfcatalogsignal));
+    }
+    if (ok)
+    {
+        rest -= hdr.signals * sizeof(edfcatalogsignal);
+        ok = (hdr.strings <= rest);
+    }
+
+    if (!ok)
+    {
+        fclose(f);
+        return fail("Error, catalog %s is damaged", path);
+    }
+
+    filelist.resize(hdr.files);
+    signallist.resize(hdr.signals);
+    strings.resize(hdr.strings);
+
+    ok = (fread(filelist.data(), sizeof(edfcatalogfile), filelist.size(), f) == filelist.size())
+        && (fread(signallist.data(), sizeof(edfcatalogsignal), signallist.size(), f) == signallist.size())
+        && (fread(strings.data(), 1, strings.size(), f) == strings.size());
+
+    fclose(f);
+
+    /* every offset must stay inside its table */
+    for (i = 0; ok && (i < hdr.files); i++)
+    {
+        ok = (filelist[i].path < hdr.strings) && (filelist[i].patient < hdr.strings) && (filelist[i].recording < hdr.strings)
+            && ((uint64_t)filelist[i].first_signal + filelist[i].signals <= hdr.signals);
+    }
+
+    for (i = 0; ok && (i < hdr.signals); i++)
+        ok = (signallist[i].label < hdr.strings) && (signallist[i].units < hdr.strings);
+
+    ok = ok && (strings.empty() || (strings.back() == 0));
+
+    if (!ok)
+    {
+        clear();
+        return fail("Error, catalog %s is damaged", path);
+    }
+
+    return(0);
+}
+
+inline int EdfCatalog::find_signal(int i, const char* label, double min_rate) const
+{
+    const edfcatalogfile& f = filelist[i];
+
+    int len = (label == NULL) ? 0 : edf_field_len(label, strlen(label));
+
+    uint32_t j;
+
+    for (j = f.first_signal; j < f.first_signal + f.signals; j++)
+    {
+        const edfcatalogsignal& s = signallist[j];
+
+        if (s.annotation || (s.samplerate < min_rate))
+            continue;
+
+        if (len && (strncmp(text(s.label), label, len) || (text(s.label)[len] != 0)))
+            continue;
+
+        return j;
+    }
+
+    return(-1);
+}
+
+inline std::vector<int> EdfCatalog::find(const char* label, double min_rate) const
+{
+    std::vector<int> found;
+
+    for (int i = 0; i < files(); i++)
+    {
+        if (find_signal(i, label, min_rate) >= 0)
+            found.push_back(i);
+    }
+
+    return found;
+}
+
+#endif
@@ -0,0 +1,411 @@
+/*
+***************************************************************************
+*
+* Author: LetMeFly Tisfy & Teunis van Beelen
+*
+* Copyright (C) 2022 LetMeFly Tisfy & Teunis van Beelen
+*
+* Tisfy@foxmail.com & teuniz@gmail.com
+*
+***************************************************************************
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation version 2 of the License.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*
+***************************************************************************
+*
+* This version of GPL is at https://www.gnu.org/licenses/gpl-3.0.txt
+*
+***************************************************************************
+*/
+
+/*
+ * Sample conversion kernels: digital EDF and BDF samples to physical values.
+ *
+ * Every kernel computes dst[k * stride] = (src[k] + offset) * sense with the
+ * add and the multiply done in double, exactly like the scalar code, so all
+ * of them give bit-identical results. (A fused multiply-add would round once
+ * instead of twice and is therefore not used.) Results are converted to the
+ * destination type only after the multiply.
+ *
+ * The 24-bit BDF kernels first shuffle each 3-byte sample into the upper three
+ * bytes of a 32-bit lane and shift it back arithmetically, which sign-extends
+ * without a branch.
+ *
+ * On x86 the widest of SSE2 (SSSE3 for BDF), AVX2 and AVX-512 that the CPU
+ * supports is picked at the first call. The environment variable EDF2EIGEN_SIMD (scalar, sse2,
+ * avx2 or avx512) lowers that choice, e.g. to compare the paths.
+ */
+
+#ifndef EDFCONVERT_H
+#define EDFCONVERT_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define EDF_HAVE_X86_SIMD
+#endif
+
+enum { EDF_SIMD_SCALAR, EDF_SIMD_SSE2, EDF_SIMD_AVX2, EDF_SIMD_AVX512 };
+
+/* the best instruction set both the CPU and EDF2EIGEN_SIMD allow */
+inline int edf_simd_level()
+{
+    static const int level = []
+    {
+        int cpu = EDF_SIMD_SCALAR,
+            cap = EDF_SIMD_AVX512;
+
+        const char* env = getenv("EDF2EIGEN_SIMD");
+
+#ifdef EDF_HAVE_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse2"))
+            cpu = EDF_SIMD_SSE2;
+        if (__builtin_cpu_supports("avx2"))
+            cpu = EDF_SIMD_AVX2;
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+            cpu = EDF_SIMD_AVX512;
+#endif
+
+        if (env != NULL)
+        {
+            if (!strcmp(env, "scalar"))
+                cap = EDF_SIMD_SCALAR;
+            else if (!strcmp(env, "sse2"))
+                cap = EDF_SIMD_SSE2;
+            else if (!strcmp(env, "avx2"))
+                cap = EDF_SIMD_AVX2;
+        }
+
+        return cpu < cap ? cpu : cap;
+    }();
+
+    return level;
+}
+
+template<typename T>
+inline void edf_convert_i16_scalar(const signed short* src, int n, double offset, double sense, T* dst, ptrdiff_t stride)
+{
+    for (int k = 0; k < n; k++)
+    {
+        dst[k * stride] = (T)((src[k] + offset) * sense);
+    }
+}
+
+#ifdef EDF_HAVE_X86_SIMD
+
+/* stores of one vector of results, contiguous or spread over a stride */
+
+__attribute__((target("sse2")))
+inline void edf_store2(double* dst, ptrdiff_t stride, __m128d v)
+{
+    if (stride == 1)
+    {
+        _mm_storeu_pd(dst, v);
+        return;
+    }
+
+    _mm_storel_pd(dst, v);
+    _mm_storeh_pd(dst + stride, v);
+}
+
+__attribute__((target("sse2")))
+inline void edf_store2(float* dst, ptrdiff_t stride, __m128d v)
+{
+    float tmp[4];
+
+    _mm_storeu_ps(tmp, _mm_cvtpd_ps(v));
+    dst[0] = tmp[0];
+    dst[stride] = tmp[1];
+}
+
+__attribute__((target("avx2")))
+inline void edf_store4(double* dst, ptrdiff_t stride, __m256d v)
+{
+    double tmp[4];
+
+    if (stride == 1)
+    {
+        _mm256_storeu_pd(dst, v);
+        return;
+    }
+
+    _mm256_storeu_pd(tmp, v);
+    for (int i = 0; i < 4; i++)
+        dst[i * stride] = tmp[i];
+}
+
+__attribute__((target("avx2")))
+inline void edf_store4(float* dst, ptrdiff_t stride, __m256d v)
+{
+    float tmp[4];
+
+    if (stride == 1)
+    {
+        _mm_storeu_ps(dst, _mm256_cvtpd_ps(v));
+        return;
+    }
+
+    _mm_storeu_ps(tmp, _mm256_cvtpd_ps(v));
+    for (int i = 0; i < 4; i++)
+        dst[i * stride] = tmp[i];
+}
+
+__attribute__((target("avx512f")))
+inline void edf_store8(double* dst, ptrdiff_t stride, __m512d v)
+{
+    double tmp[8];
+
+    if (stride == 1)
+    {
+        _mm512_storeu_pd(dst, v);
+        return;
+    }
+
+    _mm512_storeu_pd(tmp, v);
+    for (int i = 0; i < 8; i++)
+        dst[i * stride] = tmp[i];
+}
+
+__attribute__((target("avx512f")))
+inline void edf_store8(float* dst, ptrdiff_t stride, __m512d v)
+{
+    float tmp[8];
+
+    if (stride == 1)
+    {
+        _mm256_storeu_ps(dst, _mm512_maskz_cvtpd_ps(0xff, v));
+        return;
+    }
+
+    _mm256_storeu_ps(tmp, _mm512_maskz_cvtpd_ps(0xff, v));
+    for (int i = 0; i < 8; i++)
+        dst[i * stride] = tmp[i];
+}
+
+template<typename T>
+__attribute__((target("sse2")))
+inline void edf_convert_i16_sse2(const signed short* src, int n, double offset, double sense, T* dst, ptrdiff_t stride)
+{
+    int k;
+
+    const __m128d off = _mm_set1_pd(offset),
+        sns = _mm_set1_pd(sense);
+
+    for (k = 0; k + 8 <= n; k += 8)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + k)),
+            lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16),
+            hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+
+        edf_store2(dst + k * stride, stride, _mm_mul_pd(_mm_add_pd(_mm_cvtepi32_pd(lo), off), sns));
+        edf_store2(dst + (k + 2) * stride, stride, _mm_mul_pd(_mm_add_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(lo, lo)), off), sns));
+        edf_store2(dst + (k + 4) * stride, stride, _mm_mul_pd(_mm_add_pd(_mm_cvtepi32_pd(hi), off), sns));
+        edf_store2(dst + (k + 6) * stride, stride, _mm_mul_pd(_mm_add_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(hi, hi)), off), sns));
+    }
+
+    edf_convert_i16_scalar(src + k, n - k, offset, sense, dst + k * stride, stride);
+}
+
+template<typename T>
+__attribute__((target("avx2")))
+inline void edf_convert_i16_avx2(const signed short* src, int n, double offset, double sense, T* dst, ptrdiff_t stride)
+{
+    int k;
+
+    const __m256d off = _mm256_set1_pd(offset),
+        sns = _mm256_set1_pd(sense);
+
+    for (k = 0; k + 8 <= n; k += 8)
+    {
+        __m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + k)));
+
+        edf_store4(dst + k * stride, stride, _mm256_mul_pd(_mm256_add_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(x)), off), sns));
+        edf_store4(dst + (k + 4) * stride, stride, _mm256_mul_pd(_mm256_add_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(x, 1)), off), sns));
+    }
+
+    edf_convert_i16_scalar(src + k, n - k, offset, sense, dst + k * stride, stride);
+}
+
+template<typename T>
+__attribute__((target("avx512f")))
+inline void edf_convert_i16_avx512(const signed short* src, int n, double offset, double sense, T* dst, ptrdiff_t stride)
+{
+    int k;
+
+    const __m512d off = _mm512_set1_pd(offset),
+        sns = _mm512_set1_pd(sense);
+
+    /* here and below the maskz forms avoid the _mm512_undefined_*() operands gcc warns about */
+    for (k = 0; k + 8 <= n; k += 8)
+    {
+        __m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + k)));
+
+        edf_store8(dst + k * stride, stride, _mm512_mul_pd(_mm512_add_pd(_mm512_maskz_cvtepi32_pd(0xff, x), off), sns));
+    }
+
+    edf_convert_i16_scalar(src + k, n - k, offset, sense, dst + k * stride, stride);
+}
+
+#endif
+
+template<typename T>
+inline void edf_convert_i24_scalar(const unsigned char* src, int n, double offset, double sense, T* dst, ptrdiff_t stride)
+{
+    for (int k = 0; k < n; k++)
+    {
+        int one = src[k * 3] | (src[k * 3 + 1] << 8) | (src[k * 3 + 2] << 16);
+
+        one = (one ^ 0x800000) - 0x800000;  /* sign extend 24 bits */
+
+        dst[k * stride] = (T)((one + offset) * sense);
+    }
+}
+
+#ifdef EDF_HAVE_X86_SIMD
+
+/* byte b of sample i goes to byte 4 * i + b + 1 of the lane, byte 4 * i stays zero */
+#define EDF_I24_SHUFFLE -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11
+
+/* the vector loops stop while a full 16-byte load still fits in the 3 * n input bytes */
+
+template<typename T>
+__attribute__((target("ssse3")))
+inline void edf_convert_i24_ssse3(const unsigned char* src, int n, double offset, double sense, T* dst, ptrdiff_t stride)
+{
+    int k;
+
+    const __m128i shuf = _mm_setr_epi8(EDF_I24_SHUFFLE);
+
+    const __m128d off = _mm_set1_pd(offset),
+        sns = _mm_set1_pd(sense);
+
+    for (k = 0; 3 * k + 16 <= 3 * n; k += 4)
+    {
+        __m128i x = _mm_srai_epi32(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + 3 * k)), shuf), 8);
+
+        edf_store2(dst + k * stride, stride, _mm_mul_pd(_mm_add_pd(_mm_cvtepi32_pd(x), off), sns));
+        edf_store2(dst + (k + 2) * stride, stride, _mm_mul_pd(_mm_add_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(x, x)), off), sns));
+    }
+
+    edf_convert_i24_scalar(src + 3 * k, n - k, offset, sense, dst + k * stride, stride);
+}
+
+template<typename T>
+__attribute__((target("avx2")))
+inline void edf_convert_i24_avx2(const unsigned char* src, int n, double offset, double sense, T* dst, ptrdiff_t stride)
+{
+    int k;
+
+    const __m256i shuf = _mm256_setr_epi8(EDF_I24_SHUFFLE, EDF_I24_SHUFFLE);
+
+    const __m256d off = _mm256_set1_pd(offset),
+        sns = _mm256_set1_pd(sense);
+
+    for (k = 0; 3 * k + 28 <= 3 * n; k += 8)
+    {
+        __m256i x = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(src + 3 * k))),
+                _mm_loadu_si128((const __m128i*)(src + 3 * k + 12)), 1);
+
+        x = _mm256_srai_epi32(_mm256_shuffle_epi8(x, shuf), 8);
+
+        edf_store4(dst + k * stride, stride, _mm256_mul_pd(_mm256_add_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(x)), off), sns));
+        edf_store4(dst + (k + 4) * stride, stride, _mm256_mul_pd(_mm256_add_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(x, 1)), off), sns));
+    }
+
+    edf_convert_i24_scalar(src + 3 * k, n - k, offset, sense, dst + k * stride, stride);
+}
+
+template<typename T>
+__attribute__((target("avx512f,avx512bw")))
+inline void edf_convert_i24_avx512(const unsigned char* src, int n, double offset, double sense, T* dst, ptrdiff_t stride)
+{
+    int k;
+
+    const __m512i shuf = _mm512_maskz_broadcast_i32x4(0xffff, _mm_setr_epi8(EDF_I24_SHUFFLE));
+
+    const __m512d off = _mm512_set1_pd(offset),
+        sns = _mm512_set1_pd(sense);
+
+    for (k = 0; 3 * k + 52 <= 3 * n; k += 16)
+    {
+        __m512i x = _mm512_inserti32x4(_mm512_inserti32x4(_mm512_inserti32x4(_mm512_castsi128_si512(
+                _mm_loadu_si128((const __m128i*)(src + 3 * k))),
+                _mm_loadu_si128((const __m128i*)(src + 3 * k + 12)), 1),
+                _mm_loadu_si128((const __m128i*)(src + 3 * k + 24)), 2),
+                _mm_loadu_si128((const __m128i*)(src + 3 * k + 36)), 3);
+
+        x = _mm512_maskz_srai_epi32(0xffff, _mm512_shuffle_epi8(x, shuf), 8);
+
+        edf_store8(dst + k * stride, stride, _mm512_mul_pd(_mm512_add_pd(_mm512_maskz_cvtepi32_pd(0xff, _mm512_maskz_extracti64x4_epi64(0xf, x, 0)), off), sns));
+        edf_store8(dst + (k + 8) * stride, stride, _mm512_mul_pd(_mm512_add_pd(_mm512_maskz_cvtepi32_pd(0xff, _mm512_maskz_extracti64x4_epi64(0xf, x, 1)), off), sns));
+    }
+
+    edf_convert_i24_scalar(src + 3 * k, n - k, offset, sense, dst + k * stride, stride);
+}
+
+#undef EDF_I24_SHUFFLE
+
+#endif
+
+/* converts n contiguous 16-bit EDF samples of one signal */
+template<typename T>
+inline void edf_convert_i16(const signed short* src, int n, double offset, double sense, T* dst, ptrdiff_t stride)
+{
+    typedef void (*kernel)(const signed short*, int, double, double, T*, ptrdiff_t);
+
+    static const kernel fn = []
+    {
+#ifdef EDF_HAVE_X86_SIMD
+        switch (edf_simd_level())
+        {
+            case EDF_SIMD_AVX512: return (kernel)edf_convert_i16_avx512<T>;
+            case EDF_SIMD_AVX2: return (kernel)edf_convert_i16_avx2<T>;
+            case EDF_SIMD_SSE2: return (kernel)edf_convert_i16_sse2<T>;
+        }
+#endif
+        return (kernel)edf_convert_i16_scalar<T>;
+    }();
+
+    fn(src, n, offset, sense, dst, stride);
+}
+
+/* converts n contiguous 24-bit BDF samples of one signal, src points at the first byte */
+template<typename T>
+inline void edf_convert_i24(const unsigned char* src, int n, double offset, double sense, T* dst, ptrdiff_t stride)
+{
+    typedef void (*kernel)(const unsigned char*, int, double, double, T*, ptrdiff_t);
+
+    static const kernel fn = []
+    {
+#ifdef EDF_HAVE_X86_SIMD
+        switch (edf_simd_level())
+        {
+            case EDF_SIMD_AVX512: return (kernel)edf_convert_i24_avx512<T>;
+            case EDF_SIMD_AVX2: return (kernel)edf_convert_i24_avx2<T>;
+            case EDF_SIMD_SSE2:
+                if (__builtin_cpu_supports("ssse3"))
+                    return (kernel)edf_convert_i24_ssse3<T>;
+        }
+#endif
+        return (kernel)edf_convert_i24_scalar<T>;
+    }();
+
+    fn(src, n, offset, sense, dst, stride);
+}
+
+#endif
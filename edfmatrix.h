@@ -0,0 +1,355 @@
+/*
+***************************************************************************
+*
+* Author: LetMeFly Tisfy & Teunis van Beelen
+*
+* Copyright (C) 2022 LetMeFly Tisfy & Teunis van Beelen
+*
+* Tisfy@foxmail.com & teuniz@gmail.com
+*
+***************************************************************************
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation version 2 of the License.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*
+***************************************************************************
+*
+* This version of GPL is at https://www.gnu.org/licenses/gpl-3.0.txt
+*
+***************************************************************************
+*/
+
+/*
+ * EdfMatrixFile: a matrix in a memory-mapped file, for output that does not
+ * fit in memory.
+ *
+ * The file starts with a 64-byte header (see edfmatrixheader) padded to
+ * 4096 bytes, followed by the elements in column- or row-major order, in
+ * the byte order of the machine that wrote it. map() gives an Eigen::Map
+ * over the elements; the operating system pages them in and out as they
+ * are used, so the matrix can be much larger than RAM. A file that was
+ * written before opens again without reading it.
+ *
+ *     EdfMatrixFile out;
+ *     if (out.create("eeg.edfm", rows, reader.columns(), EDF_MATRIX_F32, false)
+ *         || reader.read_channels_into(out.map<float>()))
+ *         ...
+ *
+ * Like EdfReader, methods return 1 on failure and error() says why.
+ */
+
+#ifndef EDFMATRIX_H
+#define EDFMATRIX_H
+
+#include <Eigen/Dense>
+#include <string>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define EDF_HAVE_MATRIX_FILE
+#endif
+#include "edfsink.h"
+
+enum { EDF_MATRIX_F64, EDF_MATRIX_F32, EDF_MATRIX_F16 };
+
+struct edfmatrixheader
+{
+    char magic[8];          /* "EDFMATRX" */
+    unsigned int version;   /* 1 */
+    unsigned int dtype;     /* EDF_MATRIX_F64, EDF_MATRIX_F32 or EDF_MATRIX_F16 */
+    unsigned int row_major; /* 0 column-major, 1 row-major */
+    unsigned int reserved;
+    long long rows,
+        cols,
+        data_offset;        /* where the elements start, 4096 */
+    char pad[16];
+};
+
+static_assert(sizeof(edfmatrixheader) == 64, "edfmatrixheader must be 64 bytes");
+
+template<typename Scalar> struct edf_matrix_dtype;
+template<> struct edf_matrix_dtype<double> { enum { value = EDF_MATRIX_F64 }; };
+template<> struct edf_matrix_dtype<float> { enum { value = EDF_MATRIX_F32 }; };
+template<> struct edf_matrix_dtype<Eigen::half> { enum { value = EDF_MATRIX_F16 }; };
+
+class EdfMatrixFile
+{
+public:
+    typedef Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic> stride_type;
+
+    template<typename Scalar>
+    using map_type = Eigen::Map<Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>, 0, stride_type>;
+
+    EdfMatrixFile() {}
+    ~EdfMatrixFile() { close(); }
+
+    /* creates (or overwrites) a rows x cols matrix file, elements zero */
+    int create(const char* path, long long rows, long long cols, int dtype, bool row_major);
+    /* maps an existing matrix file, read-only unless writable */
+    int open(const char* path, bool writable = false);
+    /* writes changed pages back to the file, returns when they are on disk */
+    int flush();
+    void close();
+
+    /* the elements as a matrix, an empty one if Scalar does not match dtype() */
+    template<typename Scalar>
+    map_type<Scalar> map();
+
+    long long rows() const { return hdr.rows; }
+    long long cols() const { return hdr.cols; }
+    int dtype() const { return hdr.dtype; }
+    bool row_major() const { return hdr.row_major != 0; }
+    void* data() const { return base == NULL ? NULL : (char*)base + hdr.data_offset; }
+
+    const char* error() const { return errmsg; }
+
+    static int element_size(int dtype) { return dtype == EDF_MATRIX_F64 ? 8 : dtype == EDF_MATRIX_F32 ? 4 : 2; }
+
+private:
+    int fail(const char* fmt, ...);
+
+    int fd = -1;
+
+    void* base = NULL;
+    size_t len = 0;
+
+    edfmatrixheader hdr = {};
+
+    char errmsg[512] = "";
+
+    EdfMatrixFile(const EdfMatrixFile&) = delete;
+    EdfMatrixFile& operator=(const EdfMatrixFile&) = delete;
+};
+
+inline int EdfMatrixFile::fail(const char* fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(errmsg, sizeof(errmsg), fmt, args);
+    va_end(args);
+
+    return(1);
+}
+
+inline void EdfMatrixFile::close()
+{
+#ifdef EDF_HAVE_MATRIX_FILE
+    if (base != NULL)
+        munmap(base, len);
+
+    if (fd >= 0)
+        ::close(fd);
+#endif
+
+    base = NULL;
+    len = 0;
+    fd = -1;
+    hdr = edfmatrixheader();
+}
+
+inline int EdfMatrixFile::create(const char* path, long long rows, long long cols, int dtype, bool row_major)
+{
+    close();
+
+#ifdef EDF_HAVE_MATRIX_FILE
+    long long bytes;
+
+    if ((dtype < EDF_MATRIX_F64) || (dtype > EDF_MATRIX_F16) || (rows < 0) || (cols < 0))
+    {
+        return fail("Error, invalid matrix of %lli x %lli, type %i", rows, cols, dtype);
+    }
+
+    if ((cols > 0) && (rows > (0x7fffffffffffffffLL - 4096) / cols / element_size(dtype)))
+    {
+        return fail("Error, matrix of %lli x %lli is too large", rows, cols);
+    }
+
+    bytes = 4096 + rows * cols * element_size(dtype);
+
+    if ((long long)(size_t)bytes != bytes)
+    {
+        return fail("Error, matrix of %lli bytes can not be mapped", bytes);
+    }
+
+    fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return fail("Error, can not open file %s for writing", path);
+    }
+
+    if (ftruncate(fd, bytes))
+    {
+        close();
+        return fail("Error, can not make %s %lli bytes large", path, bytes);
+    }
+
+    base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        base = NULL;
+        close();
+        return fail("Error, can not map %s", path);
+    }
+
+    len = bytes;
+
+    memcpy(hdr.magic, "EDFMATRX", 8);
+    hdr.version = 1;
+    hdr.dtype = dtype;
+    hdr.row_major = row_major;
+    hdr.rows = rows;
+    hdr.cols = cols;
+    hdr.data_offset = 4096;
+
+    memcpy(base, &hdr, sizeof(hdr));
+
+    /* decoders fill the matrix front to back */
+    madvise(base, len, MADV_SEQUENTIAL);
+
+    return(0);
+#else
+    (void)path; (void)rows; (void)cols; (void)dtype; (void)row_major;
+
+    return fail("Error, memory-mapped matrix files are not supported on this platform");
+#endif
+}
+
+inline int EdfMatrixFile::open(const char* path, bool writable)
+{
+    close();
+
+#ifdef EDF_HAVE_MATRIX_FILE
+    struct stat st;
+
+    fd = ::open(path, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0)
+    {
+        return fail("Error, can not open file %s", path);
+    }
+
+    if (fstat(fd, &st) || (st.st_size < 4096) || ((long long)(size_t)st.st_size != (long long)st.st_size))
+    {
+        close();
+        return fail("Error, %s is not a matrix file", path);
+    }
+
+    base = mmap(NULL, st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        base = NULL;
+        close();
+        return fail("Error, can not map %s", path);
+    }
+
+    len = st.st_size;
+
+    memcpy(&hdr, base, sizeof(hdr));
+
+    if (memcmp(hdr.magic, "EDFMATRX", 8) || (hdr.version != 1) || (hdr.dtype > EDF_MATRIX_F16)
+        || (hdr.rows < 0) || (hdr.cols < 0) || (hdr.data_offset < (long long)sizeof(hdr))
+        || ((hdr.cols > 0) && (hdr.rows > ((long long)len - hdr.data_offset) / hdr.cols / element_size(hdr.dtype))))
+    {
+        close();
+        return fail("Error, %s is not a matrix file or it is truncated", path);
+    }
+
+    return(0);
+#else
+    (void)path; (void)writable;
+
+    return fail("Error, memory-mapped matrix files are not supported on this platform");
+#endif
+}
+
+inline int EdfMatrixFile::flush()
+{
+#ifdef EDF_HAVE_MATRIX_FILE
+    if ((base != NULL) && msync(base, len, MS_SYNC))
+    {
+        return fail("Error, can not write the matrix back to its file");
+    }
+#endif
+
+    return(0);
+}
+
+template<typename Scalar>
+EdfMatrixFile::map_type<Scalar> EdfMatrixFile::map()
+{
+    if ((base == NULL) || ((int)hdr.dtype != (int)edf_matrix_dtype<Scalar>::value))
+    {
+        fail("Error, the matrix file does not hold this element type");
+        return map_type<Scalar>(NULL, 0, 0, stride_type(0, 1));
+    }
+
+    if (hdr.row_major)
+        return map_type<Scalar>((Scalar*)data(), hdr.rows, hdr.cols, stride_type(1, hdr.cols));
+
+    return map_type<Scalar>((Scalar*)data(), hdr.rows, hdr.cols, stride_type(hdr.rows, 1));
+}
+
+/* an output sink (edfsink.h) that decodes straight into a new matrix file */
+template<typename Scalar>
+class EdfMatrixFileSink : public EdfSink<Scalar>
+{
+public:
+    typedef typename EdfSink<Scalar>::block_type block_type;
+    typedef typename EdfSink<Scalar>::stride_type stride_type;
+
+    EdfMatrixFileSink(const char* p, bool row_major = false) : path(p), rm(row_major) {}
+
+    EdfMatrixFile file;
+
+    int begin(long long rows, long long cols) override
+    {
+        if (file.create(path.c_str(), rows, cols, edf_matrix_dtype<Scalar>::value, rm))
+        {
+            return this->fail("%s", file.error());
+        }
+
+        return(0);
+    }
+
+    block_type block(long long first_row, long long rows, long long cols) override
+    {
+        const long long rs = rm ? file.cols() : 1,
+            cs = rm ? 1 : file.rows();
+
+        return block_type((Scalar*)file.data() + first_row * rs, rows, cols, stride_type(cs, rs));
+    }
+
+    int write(const block_type& block, long long first_row) override { (void)block; (void)first_row; return(0); }
+
+    int end() override
+    {
+        if (file.flush())
+        {
+            return this->fail("%s", file.error());
+        }
+
+        return(0);
+    }
+
+private:
+    std::string path;
+
+    bool rm;
+};
+
+#endif
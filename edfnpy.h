@@ -0,0 +1,849 @@
+/*
+***************************************************************************
+*
+* Author: LetMeFly Tisfy & Teunis van Beelen
+*
+* Copyright (C) 2022 LetMeFly Tisfy & Teunis van Beelen
+*
+* Tisfy@foxmail.com & teuniz@gmail.com
+*
+***************************************************************************
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation version 2 of the License.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*
+***************************************************************************
+*
+* This version of GPL is at https://www.gnu.org/licenses/gpl-3.0.txt
+*
+***************************************************************************
+*/
+
+/*
+ * EdfNpyWriter: decoded samples as NumPy .npy and .npz files.
+ *
+ * write_npy() writes one matrix with its element type, shape and storage
+ * order, so np.load() gives it back without a copy or a transpose.
+ * write_npz() decodes the selected channels of an EdfReader into an
+ * uncompressed .npz (a zip of .npy files, zip64 when it grows past 4 GB)
+ * with one 1-D array per channel, named after its label, and the arrays
+ *
+ *     labels, units       the signal headers of the channels (bytes)
+ *     samplerate          samples per second of each channel
+ *     header              the first 256 bytes of the EDF/BDF header
+ *     record_duration     seconds per datarecord
+ *     first_record        the first decoded datarecord
+ *
+ * Every array goes to the file in one writev() of its headers and its
+ * samples, straight from the matrix. EdfNpySink streams a decode into an
+ * .npy file block by block instead.
+ */
+
+#ifndef EDFNPY_H
+#define EDFNPY_H
+
+#include <string>
+#include <vector>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "edfreader.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define EDF_HAVE_WRITEV
+#endif
+
+inline bool edf_little_endian()
+{
+    const unsigned short one = 1;
+
+    return *(const unsigned char*)&one == 1;
+}
+
+/* CRC-32 as used by zip, eight bytes at a time on little-endian machines */
+inline unsigned int edf_crc32(unsigned int crc, const void* buf, size_t len)
+{
+    struct table
+    {
+        unsigned int t[8][256];
+
+        table()
+        {
+            for (unsigned int i = 0; i < 256; i++)
+            {
+                unsigned int c = i;
+                for (int k = 0; k < 8; k++)
+                    c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+                t[0][i] = c;
+            }
+            for (int k = 1; k < 8; k++)
+                for (int i = 0; i < 256; i++)
+                    t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+        }
+    };
+
+    static const table tab;
+
+    const unsigned int (*t)[256] = tab.t;
+
+    const unsigned char* p = (const unsigned char*)buf;
+
+    unsigned int a, b;
+
+    crc = ~crc;
+
+    if (edf_little_endian())
+    {
+        for (; len >= 8; p += 8, len -= 8)
+        {
+            memcpy(&a, p, 4);
+            memcpy(&b, p + 4, 4);
+            a ^= crc;
+            crc = t[7][a & 0xff] ^ t[6][(a >> 8) & 0xff] ^ t[5][(a >> 16) & 0xff] ^ t[4][a >> 24]
+                ^ t[3][b & 0xff] ^ t[2][(b >> 8) & 0xff] ^ t[1][(b >> 16) & 0xff] ^ t[0][b >> 24];
+        }
+    }
+
+    for (; len > 0; len--)
+        crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+/* NumPy type code of an element type, without the byte order */
+template<typename Scalar> struct edf_npy_type;
+template<> struct edf_npy_type<double> { static const char* code() { return "f8"; } };
+template<> struct edf_npy_type<float> { static const char* code() { return "f4"; } };
+template<> struct edf_npy_type<Eigen::half> { static const char* code() { return "f2"; } };
+template<> struct edf_npy_type<int> { static const char* code() { return "i4"; } };
+template<> struct edf_npy_type<long long> { static const char* code() { return "i8"; } };
+
+class EdfNpyWriter
+{
+public:
+    EdfNpyWriter() {}
+    ~EdfNpyWriter() { close(); }
+
+    /* writes mat as a .npy file; a vector type gives a 1-D array */
+    template<typename Derived>
+    int write_npy(const char* path, const Eigen::MatrixBase<Derived>& mat);
+
+    /* an .npy file written in pieces: begin_npy() with the final rows x cols, */
+    /* then append() the samples in C order until they are all there          */
+    template<typename Scalar>
+    int begin_npy(const char* path, long long rows, long long cols);
+    int append(const void* data, size_t bytes);
+
+    /* decodes the selected channels of reader into a .npz file (see above) */
+    template<typename Scalar>
+    int write_npz(const char* path, EdfReader& reader);
+
+    /* the steps of write_npz(): open_npz(), an add() per array, close_npz() */
+    int open_npz(const char* path);
+    template<typename Derived>
+    int add(const char* name, const Eigen::MatrixBase<Derived>& mat);
+    /* a 1-D array of byte strings, as wide as the longest one */
+    int add_strings(const char* name, const std::vector<std::string>& strings);
+    int close_npz();
+
+    /* closes the file without finishing it */
+    void close();
+
+    const char* error() const { return errmsg; }
+
+private:
+    struct iov
+    {
+        const void* base;
+        size_t len;
+    };
+
+    struct entry
+    {
+        std::string name;
+        unsigned int crc;
+        long long size,
+            offset;
+    };
+
+    int fail(const char* fmt, ...);
+    int create(const char* path);
+    int put(iov* v, int n);
+    int add_array(const char* name, const char* type, bool fortran_order, const long long* shape, int dims, const void* data, long long bytes);
+
+    std::string path;
+
+#ifdef EDF_HAVE_WRITEV
+    int fd = -1;
+#else
+    FILE* file = NULL;
+#endif
+
+    long long pos = 0;
+
+    bool zip = false;
+
+    std::vector<entry> entries;
+
+    char errmsg[512] = "";
+
+    EdfNpyWriter(const EdfNpyWriter&) = delete;
+    EdfNpyWriter& operator=(const EdfNpyWriter&) = delete;
+};
+
+inline int EdfNpyWriter::fail(const char* fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(errmsg, sizeof(errmsg), fmt, args);
+    va_end(args);
+
+    return(1);
+}
+
+inline void EdfNpyWriter::close()
+{
+#ifdef EDF_HAVE_WRITEV
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+#else
+    if (file != NULL)
+        fclose(file);
+    file = NULL;
+#endif
+
+    pos = 0;
+    zip = false;
+    entries.clear();
+}
+
+inline int EdfNpyWriter::create(const char* p)
+{
+    close();
+
+    path = p;
+
+#ifdef EDF_HAVE_WRITEV
+    fd = ::open(p, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+#else
+    file = fopen(p, "wb");
+    if (file == NULL)
+#endif
+    {
+        return fail("Error, can not open file %s for writing", p);
+    }
+
+    return(0);
+}
+
+/* writes all of v, which it uses up */
+inline int EdfNpyWriter::put(iov* v, int n)
+{
+#ifdef EDF_HAVE_WRITEV
+    struct iovec vec[4];
+
+    ssize_t done;
+
+    int i;
+
+    while (n > 0)
+    {
+        for (i = 0; i < n; i++)
+        {
+            vec[i].iov_base = (void*)v[i].base;
+            vec[i].iov_len = v[i].len;
+        }
+
+        done = writev(fd, vec, n);
+        if (done < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return fail("Error, can not write to %s", path.c_str());
+        }
+
+        pos += done;
+
+        for (; (n > 0) && ((size_t)done >= v->len); n--)
+            done -= (v++)->len;
+
+        if (n > 0)
+        {
+            v->base = (const char*)v->base + done;
+            v->len -= done;
+        }
+    }
+#else
+    for (int i = 0; i < n; i++)
+    {
+        if (fwrite(v[i].base, 1, v[i].len, file) != v[i].len)
+        {
+            return fail("Error, can not write to %s", path.c_str());
+        }
+
+        pos += v[i].len;
+    }
+#endif
+
+    return(0);
+}
+
+inline void edf_put16(std::string& s, unsigned int x)
+{
+    s += (char)(x & 0xff);
+    s += (char)((x >> 8) & 0xff);
+}
+
+inline void edf_put32(std::string& s, unsigned int x)
+{
+    edf_put16(s, x & 0xffff);
+    edf_put16(s, x >> 16);
+}
+
+inline void edf_put64(std::string& s, unsigned long long x)
+{
+    edf_put32(s, (unsigned int)x);
+    edf_put32(s, (unsigned int)(x >> 32));
+}
+
+/* an .npy file up to its data, padded to a multiple of 64 bytes */
+inline std::string edf_npy_header(const char* type, bool fortran_order, const long long* shape, int dims)
+{
+    std::string dict = "{'descr': '",
+        s = "\x93NUMPY\x01";
+    char num[32];
+
+    dict += type;
+    dict += fortran_order ? "', 'fortran_order': True, 'shape': (" : "', 'fortran_order': False, 'shape': (";
+    for (int i = 0; i < dims; i++)
+    {
+        snprintf(num, sizeof(num), i ? " %lli," : "%lli,", shape[i]);
+        dict += num;
+    }
+    if (dims > 1)
+        dict.pop_back();
+    dict += "), }";
+
+    dict.append(63 - (10 + dict.size()) % 64, ' ');
+    dict += '\n';
+
+    s += '\0';
+    edf_put16(s, (unsigned int)dict.size());
+
+    return s + dict;
+}
+
+inline int EdfNpyWriter::add_array(const char* name, const char* type, bool fortran_order, const long long* shape, int dims, const void* data, long long bytes)
+{
+    std::string hdr = edf_npy_header(type, fortran_order, shape, dims),
+        local;
+
+    entry e;
+
+    if (!zip)
+    {
+        iov v[2] = { { hdr.data(), hdr.size() }, { data, (size_t)bytes } };
+
+        return put(v, 2);
+    }
+
+    e.name = name;
+    e.name += ".npy";
+    e.size = (long long)hdr.size() + bytes;
+    e.offset = pos;
+    e.crc = edf_crc32(edf_crc32(0, hdr.data(), hdr.size()), data, bytes);
+
+    edf_put32(local, 0x04034b50);
+    edf_put16(local, e.size >= 0xffffffffLL ? 45 : 20);
+    edf_put16(local, 0);                        /* flags */
+    edf_put16(local, 0);                        /* stored */
+    edf_put16(local, 0);                        /* time */
+    edf_put16(local, 0x21);                     /* date, 1980-01-01 */
+    edf_put32(local, e.crc);
+    if (e.size >= 0xffffffffLL)
+    {
+        edf_put32(local, 0xffffffff);
+        edf_put32(local, 0xffffffff);
+        edf_put16(local, (unsigned int)e.name.size());
+        edf_put16(local, 20);
+        local += e.name;
+        edf_put16(local, 1);                    /* zip64 sizes */
+        edf_put16(local, 16);
+        edf_put64(local, e.size);
+        edf_put64(local, e.size);
+    }
+    else
+    {
+        edf_put32(local, (unsigned int)e.size);
+        edf_put32(local, (unsigned int)e.size);
+        edf_put16(local, (unsigned int)e.name.size());
+        edf_put16(local, 0);
+        local += e.name;
+    }
+
+    entries.push_back(e);
+
+    iov v[3] = { { local.data(), local.size() }, { hdr.data(), hdr.size() }, { data, (size_t)bytes } };
+
+    return put(v, 3);
+}
+
+template<typename Derived>
+int EdfNpyWriter::add(const char* name, const Eigen::MatrixBase<Derived>& mat)
+{
+    typedef typename Derived::Scalar Scalar;
+
+    const bool vector = (Derived::RowsAtCompileTime == 1) || (Derived::ColsAtCompileTime == 1),
+        row_major = (Derived::Flags & Eigen::RowMajorBit) != 0;
+
+    long long shape[2] = { mat.rows(), mat.cols() };
+
+    std::string type = edf_little_endian() ? "<" : ">";
+
+    if constexpr (!(Derived::Flags & Eigen::DirectAccessBit))
+    {
+        return add(name, typename Derived::PlainObject(mat));
+    }
+    else
+    {
+        /* the samples must be one block of memory in storage order */
+        if ((mat.size() > 1) && ((mat.innerStride() != 1) || ((mat.outerSize() > 1) && (mat.outerStride() != mat.innerSize()))))
+        {
+            return add(name, typename Derived::PlainObject(mat));
+        }
+
+        if (vector)
+            shape[0] = mat.size();
+
+        type += edf_npy_type<Scalar>::code();
+
+        return add_array(name, type.c_str(), !row_major && !vector, shape, vector ? 1 : 2, mat.derived().data(), (long long)mat.size() * sizeof(Scalar));
+    }
+}
+
+inline int EdfNpyWriter::add_strings(const char* name, const std::vector<std::string>& strings)
+{
+    std::vector<char> data;
+
+    char type[32];
+
+    long long n = strings.size();
+
+    size_t width = 1;
+
+    for (const std::string& s : strings)
+        if (width < s.size())
+            width = s.size();
+
+    data.assign(width * strings.size(), 0);
+    for (size_t i = 0; i < strings.size(); i++)
+        memcpy(data.data() + i * width, strings[i].data(), strings[i].size());
+
+    snprintf(type, sizeof(type), "|S%i", (int)width);
+
+    return add_array(name, type, false, &n, 1, data.data(), (long long)data.size());
+}
+
+template<typename Derived>
+int EdfNpyWriter::write_npy(const char* p, const Eigen::MatrixBase<Derived>& mat)
+{
+    int err;
+
+    if (create(p))
+        return(1);
+
+    err = add(NULL, mat);
+
+    close();
+
+    return err;
+}
+
+template<typename Scalar>
+int EdfNpyWriter::begin_npy(const char* p, long long rows, long long cols)
+{
+    std::string type = edf_little_endian() ? "<" : ">",
+        hdr;
+
+    long long shape[2] = { rows, cols };
+
+    type += edf_npy_type<Scalar>::code();
+    hdr = edf_npy_header(type.c_str(), false, shape, 2);
+
+    iov v[1] = { { hdr.data(), hdr.size() } };
+
+    if (create(p) || put(v, 1))
+    {
+        close();
+        return(1);
+    }
+
+    return(0);
+}
+
+inline int EdfNpyWriter::append(const void* data, size_t bytes)
+{
+    iov v[1] = { { data, bytes } };
+
+    return put(v, 1);
+}
+
+inline int EdfNpyWriter::open_npz(const char* p)
+{
+    if (create(p))
+        return(1);
+
+    zip = true;
+
+    return(0);
+}
+
+inline int EdfNpyWriter::close_npz()
+{
+    std::string dir, end;
+
+    long long start = pos;
+
+    bool zip64 = entries.size() >= 0xffff;
+
+    int err;
+
+    for (const entry& e : entries)
+    {
+        std::string extra;
+
+        if (e.size >= 0xffffffffLL)
+        {
+            edf_put64(extra, e.size);
+            edf_put64(extra, e.size);
+        }
+        if (e.offset >= 0xffffffffLL)
+            edf_put64(extra, e.offset);
+
+        edf_put32(dir, 0x02014b50);
+        edf_put16(dir, 45);                     /* made by */
+        edf_put16(dir, extra.empty() ? 20 : 45);
+        edf_put16(dir, 0);
+        edf_put16(dir, 0);
+        edf_put16(dir, 0);
+        edf_put16(dir, 0x21);
+        edf_put32(dir, e.crc);
+        edf_put32(dir, e.size >= 0xffffffffLL ? 0xffffffff : (unsigned int)e.size);
+        edf_put32(dir, e.size >= 0xffffffffLL ? 0xffffffff : (unsigned int)e.size);
+        edf_put16(dir, (unsigned int)e.name.size());
+        edf_put16(dir, extra.empty() ? 0 : (unsigned int)extra.size() + 4);
+        edf_put16(dir, 0);                      /* comment */
+        edf_put16(dir, 0);                      /* disk */
+        edf_put16(dir, 0);                      /* attributes */
+        edf_put32(dir, 0);
+        edf_put32(dir, e.offset >= 0xffffffffLL ? 0xffffffff : (unsigned int)e.offset);
+        dir += e.name;
+        if (!extra.empty())
+        {
+            edf_put16(dir, 1);
+            edf_put16(dir, (unsigned int)extra.size());
+            dir += extra;
+        }
+    }
+
+    if ((start >= 0xffffffffLL) || ((long long)dir.size() >= 0xffffffffLL))
+        zip64 = true;
+
+    if (zip64)
+    {
+        edf_put32(end, 0x06064b50);
+        edf_put64(end, 44);
+        edf_put16(end, 45);
+        edf_put16(end, 45);
+        edf_put32(end, 0);
+        edf_put32(end, 0);
+        edf_put64(end, entries.size());
+        edf_put64(end, entries.size());
+        edf_put64(end, dir.size());
+        edf_put64(end, start);
+
+        edf_put32(end, 0x07064b50);
+        edf_put32(end, 0);
+        edf_put64(end, start + dir.size());
+        edf_put32(end, 1);
+    }
+
+    edf_put32(end, 0x06054b50);
+    edf_put16(end, 0);
+    edf_put16(end, 0);
+    edf_put16(end, zip64 ? 0xffff : (unsigned int)entries.size());
+    edf_put16(end, zip64 ? 0xffff : (unsigned int)entries.size());
+    edf_put32(end, zip64 ? 0xffffffff : (unsigned int)dir.size());
+    edf_put32(end, zip64 ? 0xffffffff : (unsigned int)start);
+    edf_put16(end, 0);
+
+    iov v[2] = { { dir.data(), dir.size() }, { end.data(), end.size() } };
+
+    err = put(v, 2);
+
+#ifdef EDF_HAVE_WRITEV
+    if (!err && ::close(fd))
+        err = fail("Error, can not write to %s", path.c_str());
+    fd = -1;
+#else
+    if (!err && fclose(file))
+        err = fail("Error, can not write to %s", path.c_str());
+    file = NULL;
+#endif
+
+    close();
+
+    return err;
+}
+
+/* An output sink that splits what EdfReader::read() gives for signals */
+/* with different samplerates into one vector per channel, so that      */
+/* write_npz() decodes every datarecord once however many channels.     */
+/* Like the matrix of the one-samplerate case, it holds all channels in */
+/* memory until they are written.                                       */
+template<typename Scalar>
+class EdfNpySplitSink : public EdfSink<Scalar>
+{
+public:
+    typedef typename EdfSink<Scalar>::block_type block_type;
+
+    explicit EdfNpySplitSink(EdfReader& reader)
+    {
+        std::vector<int> cols = reader.value_columns();
+
+        int c, j;
+
+        channel.resize(reader.columns());
+        spr.resize(reader.columns());
+        dst.resize(reader.columns());
+
+        for (c = 0; c < reader.columns(); c++)
+        {
+            spr[c] = reader.param(reader.column_signal(c)).smp_per_record;
+            channel[c].resize((Eigen::Index)spr[c] * reader.record_count());
+        }
+
+        /* value j of a datarecord is sample slot[j].sample of its channel */
+        std::vector<int> n(reader.columns(), 0);
+
+        for (j = 0; j < (int)cols.size(); j++)
+            slot.push_back({ cols[j], n[cols[j]]++ });
+    }
+
+    std::vector<Eigen::Matrix<Scalar, Eigen::Dynamic, 1>> channel;
+
+    /* blocks of about a million values */
+    int records_per_block() const { return slot.empty() ? 0 : std::max<int>(1, (1 << 20) / (int)slot.size()); }
+
+    int write(const block_type& block, long long first_row) override
+    {
+        const Scalar* v = block.data();
+
+        const int per = slot.size();
+
+        long long i;
+
+        int c, j;
+
+        (void)first_row;
+
+        /* blocks hold whole datarecords */
+        for (i = 0; i + per <= block.rows(); i += per, record++)
+        {
+            for (c = 0; c < (int)channel.size(); c++)
+                dst[c] = channel[c].data() + record * spr[c];
+
+            for (j = 0; j < per; j++)
+                dst[slot[j].column][slot[j].sample] = v[i + j];
+        }
+
+        return(0);
+    }
+
+private:
+    struct place { int column, sample; };
+
+    std::vector<place> slot;
+
+    std::vector<int> spr;
+
+    /* where the current datarecord goes in each channel */
+    std::vector<Scalar*> dst;
+
+    long long record = 0;
+};
+
+template<typename Scalar>
+int EdfNpyWriter::write_npz(const char* p, EdfReader& reader)
+{
+    static const char* const reserved[] = { "labels", "units", "samplerate", "header", "record_duration", "first_record" };
+
+    std::vector<std::string> names, labels, units;
+
+    std::vector<int> selection;
+
+    Eigen::VectorXd samplerate(reader.columns());
+
+    Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> mat;
+
+    const char* hdr = reader.header();
+
+    bool uniform = true;
+
+    int c, i, s, n, err = 0,
+        signals = reader.signals();
+
+    for (c = 0; c < reader.columns(); c++)
+    {
+        s = reader.column_signal(c);
+        selection.push_back(s);
+
+        labels.push_back(std::string(hdr + 256 + s * 16, 16));
+        labels.back().erase(labels.back().find_last_not_of(' ') + 1);
+        units.push_back(std::string(hdr + 256 + signals * 96 + s * 8, 8));
+        units.back().erase(units.back().find_last_not_of(' ') + 1);
+        samplerate[c] = reader.param(s).smp_per_record / reader.data_record_duration();
+
+        if (reader.param(s).smp_per_record != reader.param(selection[0]).smp_per_record)
+            uniform = false;
+
+        /* the label, if it is a usable file name that is not taken */
+        std::string name = labels.back();
+        for (char& ch : name)
+            if (!(((ch >= 'a') && (ch <= 'z')) || ((ch >= 'A') && (ch <= 'Z')) || ((ch >= '0') && (ch <= '9')) || (ch == '-') || (ch == '.')))
+                ch = '_';
+
+        for (n = 0, i = 0; i < 6; i++)
+            n |= (name == reserved[i]);
+        for (i = 0; i < c; i++)
+            n |= (name == names[i]);
+        if (n || name.empty())
+            name = "signal" + std::to_string(s + 1);
+        for (i = 0; i < c; i++)
+            if (name == names[i])
+                name += "_" + std::to_string(c + 1);
+
+        names.push_back(name);
+    }
+
+    if (open_npz(p))
+        return(1);
+
+    if (uniform)
+    {
+        if (reader.read_channels(mat))
+        {
+            close();
+            return fail("%s", reader.error());
+        }
+
+        for (c = 0; (c < reader.columns()) && !err; c++)
+            err = add(names[c].c_str(), mat.col(c));
+    }
+    else
+    {
+        /* one pass over the datarecords, each value going to its channel */
+        EdfNpySplitSink<Scalar> split(reader);
+
+        if (reader.read(split, split.records_per_block()))
+            err = fail("%s", reader.error());
+
+        for (c = 0; (c < reader.columns()) && !err; c++)
+            err = add(names[c].c_str(), split.channel[c]);
+    }
+
+    Eigen::Matrix<double, 1, 1> duration(reader.data_record_duration());
+    Eigen::Matrix<long long, 1, 1> first(reader.first_record());
+
+    if (!err)
+        err = add_strings("labels", labels)
+            || add_strings("units", units)
+            || add("samplerate", samplerate)
+            || add_strings("header", std::vector<std::string>(1, std::string(hdr, 256)))
+            || add("record_duration", duration)
+            || add("first_record", first);
+
+    if (err)
+    {
+        close();
+        return(1);
+    }
+
+    return close_npz();
+}
+
+/* an output sink (edfsink.h) that streams the samples into an .npy file, */
+/* rows x cols in C order                                                 */
+template<typename Scalar>
+class EdfNpySink : public EdfSink<Scalar>
+{
+public:
+    typedef typename EdfSink<Scalar>::block_type block_type;
+    typedef typename EdfSink<Scalar>::stride_type stride_type;
+
+    explicit EdfNpySink(const char* p) : path(p) {}
+
+    int begin(long long rows, long long cols) override
+    {
+        if (npy.begin_npy<Scalar>(path.c_str(), rows, cols))
+        {
+            return this->fail("%s", npy.error());
+        }
+
+        return(0);
+    }
+
+    block_type block(long long first_row, long long rows, long long cols) override
+    {
+        (void)first_row;
+
+        rowbuf.resize(rows, cols);
+
+        return block_type(rowbuf.data(), rows, cols, stride_type(1, cols));
+    }
+
+    int write(const block_type& block, long long first_row) override
+    {
+        (void)first_row;
+
+        if (npy.append(block.data(), (size_t)block.size() * sizeof(Scalar)))
+        {
+            return this->fail("%s", npy.error());
+        }
+
+        return(0);
+    }
+
+    int end() override
+    {
+        npy.close();
+        return(0);
+    }
+
+private:
+    std::string path;
+
+    EdfNpyWriter npy;
+
+    Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> rowbuf;
+};
+
+#endif
@@ -0,0 +1,2087 @@
+/*
+***************************************************************************
+*
+* Author: LetMeFly Tisfy & Teunis van Beelen
+*
+* Copyright (C) 2022 LetMeFly Tisfy & Teunis van Beelen
+*
+* Tisfy@foxmail.com & teuniz@gmail.com
+*
+***************************************************************************
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation version 2 of the License.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*
+***************************************************************************
+*
+* This version of GPL is at https://www.gnu.org/licenses/gpl-3.0.txt
+*
+***************************************************************************
+*/
+
+/*
+ * EdfReader: the decoder of edf2eigen as a library.
+ *
+ * All state lives in the EdfReader instance, so several files can be decoded
+ * at the same time in one process (one reader per file). The reader never
+ * prints and never creates files; on failure a method returns 1 and the
+ * reason is available from error().
+ *
+ * Where the platform allows it the datarecords are memory-mapped and decoded
+ * in place; pipes, short files and other inputs that can not be mapped are
+ * read one datarecord at a time into a buffer instead.
+ *
+ * With set_threads() the selected datarecords are split into one contiguous
+ * range per thread. Every thread decodes its range into its own part of the
+ * output, so the result does not depend on the number of threads.
+ *
+ * With set_pipeline() every decoding thread gets an I/O thread that reads
+ * its datarecords ahead into a ring of large buffers, so reading and
+ * decoding overlap instead of taking turns. With set_io_uring() on Linux the
+ * I/O thread keeps many reads in flight through io_uring instead of reading
+ * one buffer at a time with pread.
+ *
+ *     EdfReader reader;
+ *     Eigen::MatrixXd mat;
+ *     if (reader.open("recording.edf") || reader.read(mat))
+ *         fprintf(stderr, "%s\n", reader.error());
+ *
+ * The output can also be Eigen::MatrixXf or, for storage only, EdfMatrixXh
+ * (IEEE half). EDF samples have 16 bits and so fit a float exactly.
+ */
+
+#ifndef EDFREADER_H
+#define EDFREADER_H
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "edfannotations.h"
+#include "edfconvert.h"
+#include "edfsink.h"
+#include "edfuring.h"
+#include <limits.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define EDF_HAVE_MMAP
+#endif
+
+/* fseek to a 64-bit position; plain fseek takes a long, which has 32 bits on Windows */
+inline int edf_fseek(FILE* f, long long pos)
+{
+#if defined(_WIN32)
+    return _fseeki64(f, pos, SEEK_SET);
+#elif defined(EDF_HAVE_MMAP)
+    return fseeko(f, (off_t)pos, SEEK_SET);
+#else
+    return fseek(f, (long)pos, SEEK_SET);
+#endif
+}
+
+/* The number in a header field of len bytes, read in place with from_chars: */
+/* no copy, no allocation and no locale. Leading spaces and a '+' are        */
+/* skipped and parsing stops at the first character that does not fit, as   */
+/* with atoi() and atof(); a field without a number gives 0.                 */
+inline int edf_field_int(const char* s, int len)
+{
+    const char* end = s + len;
+
+    int v = 0;
+
+    while ((s < end) && (*s == ' '))
+        s++;
+    if ((s < end) && (*s == '+'))
+        s++;
+
+    std::from_chars(s, end, v);
+
+    return v;
+}
+
+inline double edf_field_double(const char* s, int len)
+{
+    const char* end = s + len;
+
+    double v = 0.0;
+
+    while ((s < end) && (*s == ' '))
+        s++;
+    if ((s < end) && (*s == '+'))
+        s++;
+
+    std::from_chars(s, end, v);
+
+    return v;
+}
+
+struct edfparamblock {
+    int smp_per_record;
+    int smp_written; //количество сигналов в записи
+    int dig_min;
+    int dig_max;
+    double offset;
+    int buf_offset;
+    double phys_min;
+    double phys_max;
+    double time_step;
+    double sense;
+};
+
+inline void utf8_to_latin1(char* utf8_str)
+{
+    int i, j, len;
+
+    unsigned char* str;
+
+
+    str = (unsigned char*)utf8_str;
+
+    len = strlen(utf8_str);
+
+    if (!len)
+    {
+        return;
+    }
+
+    j = 0;
+
+    for (i = 0; i < len; i++)
+    {
+        if ((str[i] < 32) || ((str[i] > 127) && (str[i] < 192)))
+        {
+            str[j++] = '.';
+
+            continue;
+        }
+
+        if (str[i] > 223)
+        {
+            str[j++] = 0;
+
+            return;  /* can only decode Latin-1 ! */
+        }
+
+        if ((str[i] & 224) == 192)  /* found a two-byte sequence containing Latin-1, Greek, Cyrillic, Coptic, Armenian, Hebrew, etc. characters */
+        {
+            if ((i + 1) == len)
+            {
+                str[j++] = 0;
+
+                return;
+            }
+
+            if ((str[i] & 252) != 192) /* it's not a Latin-1 character */
+            {
+                str[j++] = '.';
+
+                i++;
+
+                continue;
+            }
+
+            if ((str[i + 1] & 192) != 128) /* UTF-8 violation error */
+            {
+                str[j++] = 0;
+
+                return;
+            }
+
+            str[j] = str[i] << 6;
+            str[j] += (str[i + 1] & 63);
+
+            i++;
+            j++;
+
+            continue;
+        }
+
+        str[j++] = str[i];
+    }
+
+    if (j < len)
+    {
+        str[j] = 0;
+    }
+}
+
+typedef Eigen::Matrix<Eigen::half, Eigen::Dynamic, Eigen::Dynamic> EdfMatrixXh;
+
+/* digital value of sample index of a datarecord, Bdf selects 24 instead of 16 bits */
+template<bool Bdf>
+inline int edf_digital_sample(const char* rec, int index)
+{
+    if constexpr (Bdf)
+    {
+        const unsigned char* p = (const unsigned char*)rec + index * 3;
+
+        return ((p[0] | (p[1] << 8) | (p[2] << 16)) ^ 0x800000) - 0x800000;
+    }
+    else
+    {
+        return *((const signed short*)rec + index);
+    }
+}
+
+/* converts the n samples of one signal in a datarecord, Bdf selects 24 instead of 16 bits */
+template<bool Bdf, typename Scalar>
+inline void edf_convert_block(const char* src, int n, double offset, double sense, Scalar* dst, ptrdiff_t stride)
+{
+    if constexpr (Bdf)
+        edf_convert_i24((const unsigned char*)src, n, offset, sense, dst, stride);
+    else
+        edf_convert_i16((const signed short*)src, n, offset, sense, dst, stride);
+}
+
+/* half has no kernels of its own, it is rounded from the float results */
+template<bool Bdf>
+inline void edf_convert_block(const char* src, int n, double offset, double sense, Eigen::half* dst, ptrdiff_t stride)
+{
+    float tmp[256];
+
+    int k, m, i;
+
+    for (k = 0; k < n; k += m)
+    {
+        m = n - k < 256 ? n - k : 256;
+
+        edf_convert_block<Bdf>(src + k * (Bdf ? 3 : 2), m, offset, sense, tmp, 1);
+
+        for (i = 0; i < m; i++)
+            dst[(k + i) * stride] = Eigen::half(tmp[i]);
+    }
+}
+
+class EdfReader
+{
+public:
+    EdfReader() {}
+    ~EdfReader() { close(); }
+
+    /* opens an EDF(+) or BDF(+) file and parses its header */
+    int open(const char* path);
+    void close();
+
+    /* decodes the selected datarecords into a N x 1 matrix, samples in output order */
+    template<typename Scalar>
+    int read(Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& mat);
+    Eigen::MatrixXd read();
+
+    /* decodes the selected datarecords into a samples x channels matrix, one column per */
+    /* data signal (annotation signals left out); all data signals must have the */
+    /* same number of samples per record. Use a ColMajor matrix for per-channel  */
+    /* processing, a RowMajor matrix for per-timepoint processing.               */
+    template<typename Scalar, int Options>
+    int read_channels(Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Options>& mat);
+
+    /* Like read() and read_channels(), but into memory of the caller that */
+    /* already has the right size: n == samples(), or a rows x cols matrix */
+    /* with rows == record_count() * samples per record, cols == columns(). */
+    /* out may be an Eigen::Ref, Map, Block or Matrix of any strides. Once  */
+    /* a selection has been decoded, further reads of it on one thread and */
+    /* without a pipeline do not allocate.                                  */
+    template<typename Scalar>
+    int read_into(Scalar* out, long long n);
+    template<typename Scalar>
+    int read_channels_into(Scalar* out, Eigen::Index rows, Eigen::Index cols, Eigen::Index row_stride, Eigen::Index col_stride);
+    template<typename Derived>
+    int read_channels_into(Eigen::MatrixBase<Derived>& out);
+    template<typename Derived>
+    int read_channels_into(Eigen::MatrixBase<Derived>&& out) { return read_channels_into(out); }
+
+    /* Like read() and read_channels(), but into an output sink (edfsink.h), */
+    /* records_per_block datarecords at a time, or all at once for 0.        */
+    /* The record selection is the same afterwards.                          */
+    template<typename Scalar>
+    int read(EdfSink<Scalar>& sink, int records_per_block = 0) { return read_blocks(sink, false, records_per_block); }
+    template<typename Scalar>
+    int read_channels(EdfSink<Scalar>& sink, int records_per_block = 0) { return read_blocks(sink, true, records_per_block); }
+
+    /* selects the datarecords to decode (all by default, reset by open()); the */
+    /* reader seeks straight to the first one and stops after the last one.    */
+    /* A time window, in seconds from the start of the file, selects the whole */
+    /* datarecords that overlap it.                                             */
+    int set_records(int first, int count);
+    int set_time_window(double start, double duration);
+    int first_record() const { return first_rec; }
+    int record_count() const { return nrecs; }
+
+    /* selects the signals to decode and their order, by header index (counting */
+    /* from 0) or by label; they become the columns of read_channels() and set  */
+    /* the order of simultaneous samples in read(). An empty list selects all   */
+    /* data signals in header order, which is also the default after open().   */
+    /* Only the bytes of the selected signals are read from the file.           */
+    int select_signals(const std::vector<int>& signals);
+    int select_signals(const std::vector<std::string>& labels);
+    /* header index of the signal with this label (trailing spaces ignored), -1 if none */
+    int find_signal(const char* label) const;
+    int columns() const { return (int)col_ch.size(); }
+    int column_signal(int column) const { return col_ch[column]; }
+
+    /* decode with n threads, 0 for one per CPU core (default 1) */
+    void set_threads(int n) { nthreads = n > 0 ? n : (int)std::thread::hardware_concurrency(); }
+    int threads() const { return nthreads; }
+
+    /* memory-map the datarecords when possible (default on), call before open() */
+    void set_mmap(bool enable) { use_mmap = enable; }
+    bool is_mapped() const { return map != NULL; }
+
+    /* read ahead into a ring of buffers of buffer_size bytes each instead of */
+    /* using the mapping, 0 buffers to switch off (default)                   */
+    void set_pipeline(int buffers, size_t buffer_size = 4 << 20) { pipe_buffers = buffers; pipe_size = buffer_size; }
+
+    /* let the pipeline keep up to queue_depth reads in flight with io_uring, */
+    /* 0 for pread (default); falls back to pread where io_uring is missing  */
+    void set_io_uring(int queue_depth) { uring_depth = queue_depth; }
+
+    /* every annotation found while reading is printed as "onset,duration,text\n" */
+    void set_annotation_output(FILE* f) { annotationfile = f; }
+    FILE* annotation_output() const { return annotationfile; }
+
+    /* keep the annotations of the selected datarecords in annotations() while */
+    /* reading (default off); read_annotations() parses them reading only the  */
+    /* bytes of the annotation signals. Reset by every read.                    */
+    void set_annotation_store(bool enable) { store_annotations = enable; }
+    bool annotation_store() const { return store_annotations; }
+    int read_annotations();
+    const EdfAnnotations& annotations() const { return annots; }
+
+    const char* error() const { return errmsg; }
+
+    /* raw header, (signals() + 1) * 256 bytes */
+    const char* header() const { return edf_hdr.data(); }
+    int signals() const { return nsignals; }
+    int datarecords() const { return ndatarecords; }
+    double data_record_duration() const { return record_duration; }
+    int samplesize() const { return smpsize; }
+    bool is_bdf() const { return bdf; }
+    bool is_plus() const { return edfplus || bdfplus; }
+    int annotation_signals() const { return (int)annot_ch.size(); }
+    /* the signals that carry samples, in header order */
+    int data_signals() const { return (int)data_ch.size(); }
+    int data_signal(int column) const { return data_ch[column]; }
+    bool is_annotation(int signal) const;
+    const edfparamblock& param(int signal) const { return edfparam[signal]; }
+
+    /* number of values read() produces for the selected datarecords */
+    long long samples() const;
+    /* the column of every value read() produces for one datarecord, in order */
+    std::vector<int> value_columns();
+
+private:
+    int fail(const char* fmt, ...);
+    void map_file();
+
+    /* byte range of a datarecord */
+    struct byterange { int offset, len; };
+
+    /* Ring of multi-datarecord buffers that an I/O thread fills ahead of */
+    /* one decoding thread. filled and consumed count whole buffers; each  */
+    /* is only written by one side. A side that finds the ring empty (or   */
+    /* full) yields a few times and then sleeps on cond until the other   */
+    /* side moves, so a stalled read does not keep two cores busy.        */
+    struct pipeline
+    {
+        std::vector<char> ring;
+        size_t chunk_bytes = 0;
+        int nbuf = 0,
+            chunk = 0,
+            first = 0,
+            count = 0,
+            current = -1;
+        std::atomic<int> filled{0},
+            consumed{0},
+            failed{-1};
+        std::atomic<bool> stop{false};
+        std::thread io;
+
+        std::mutex lock;
+        std::condition_variable cond;
+
+        /* stores v in a counter and wakes the other side if it sleeps */
+        void publish(std::atomic<int>& counter, int v)
+        {
+            counter.store(v, std::memory_order_release);
+            std::lock_guard<std::mutex> guard(lock);
+            cond.notify_all();
+        }
+
+        /* waits until ready() holds, or stop is set */
+        template<typename Ready>
+        void wait(Ready ready)
+        {
+            for (int spin = 0; spin < 64; spin++)
+            {
+                if (ready() || stop)
+                    return;
+
+                std::this_thread::yield();
+            }
+
+            std::unique_lock<std::mutex> guard(lock);
+            cond.wait(guard, [&]() { return ready() || stop; });
+        }
+
+        ~pipeline()
+        {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stop = true;
+                cond.notify_all();
+            }
+            if (io.joinable())
+                io.join();
+        }
+    };
+
+    /* where the buffered path of one thread reads datarecords into */
+    struct recordbuf
+    {
+        std::vector<char> data;
+        int next_record = -1;
+        long long mapped_from = -1;
+        std::unique_ptr<pipeline> pipe;
+    };
+
+    void plan_reads();
+    std::vector<byterange> signal_ranges(const std::vector<int>& signals) const;
+    long long record_pos(int record) const;
+    int read_at(char* dst, size_t len, long long pos);
+    int load_record(int record, const std::vector<byterange>& rngs, recordbuf& rb, const char** buf);
+    void release_mapped(recordbuf& rb, long long pos);
+    void prefetch_mapped(int first, int count, const std::vector<byterange>& rngs);
+    void start_pipeline(recordbuf& rb, int first, int count, const std::vector<byterange>& rngs);
+    void fill_pipeline(pipeline* pipe, const std::vector<byterange>* rngs);
+    int fill_pipeline_uring(pipeline* pipe, const std::vector<byterange>* rngs);
+    int scan_annotations();
+    int process_annotations(int record, const char* buf);
+    int common_smp_per_record() const;
+    int channel_rows(Eigen::Index* rows);
+    template<typename Scalar>
+    int read_blocks(EdfSink<Scalar>& sink, bool channels, int records_per_block);
+    template<typename Job>
+    int for_records(Job job);
+    template<typename Scalar>
+    int decode_channels(Scalar* out, Eigen::Index rows, Eigen::Index rs, Eigen::Index cs);
+    template<bool Bdf, typename Scalar>
+    int decode_channels_as(Scalar* out, Eigen::Index rows, Eigen::Index rs, Eigen::Index cs);
+    template<bool Bdf, typename Scalar>
+    int decode_interleaved(Scalar* out);
+
+    FILE* inputfile = NULL;
+    FILE* annotationfile = NULL;
+
+    EdfAnnotations annots;
+
+    bool store_annotations = false,
+        collecting = false,     /* the running scan fills annots */
+        appending = false,      /* read_blocks() past its first block */
+        annotations_only = false;   /* read_annotations() is scanning */
+
+    void* map = NULL;
+    size_t map_len = 0;
+    bool use_mmap = true;
+
+    int nthreads = 1,
+        pipe_buffers = 0,
+        uring_depth = 0;
+    size_t pipe_size = 4 << 20;
+
+    int nsignals = 0,
+        ndatarecords = 0,
+        first_rec = 0,
+        nrecs = 0,
+        recordsize = 0,
+        smpsize = 0,
+        edf = 0,
+        bdf = 0,
+        edfplus = 0,
+        bdfplus = 0,
+        max_tal_ln = 0;
+
+    double record_duration = 0.0,
+        elapsedtime = 0.0;
+
+    std::vector<char> edf_hdr,
+        scratchpad,
+        time_in_txt,
+        duration_in_txt;
+
+    std::vector<edfparamblock> edfparam;
+
+    std::vector<int> annot_ch,
+        data_ch,
+        col_ch;
+
+    /* 1 for the annotation signals, indexed by signal */
+    std::vector<char> annot_flag;
+
+    /* signal of each label (trailing spaces removed), the first one if labels repeat */
+    std::unordered_map<std::string, int> label_index;
+
+    /* what plan_reads() worked out for the current selection */
+    bool planned = false;
+
+    /* byte ranges of a datarecord that are read on the buffered path, empty for all */
+    std::vector<byterange> ranges,
+        annot_ranges;
+
+    /* the output order of the samples in a datarecord when samplerates differ */
+    struct gather { int sample, column; };
+    std::vector<gather> schedule;
+    std::vector<double> col_offset,
+        col_sense;
+
+    /* the record buffer of the calling thread, kept from one read to the next */
+    recordbuf rbuf;
+
+    char errmsg[512] = "";
+    std::mutex errlock;
+
+    EdfReader(const EdfReader&) = delete;
+    EdfReader& operator=(const EdfReader&) = delete;
+};
+
+inline int EdfReader::fail(const char* fmt, ...)
+{
+    va_list args;
+
+    std::lock_guard<std::mutex> lock(errlock);
+
+    va_start(args, fmt);
+    vsnprintf(errmsg, sizeof(errmsg), fmt, args);
+    va_end(args);
+
+    return(1);
+}
+
+inline void EdfReader::close()
+{
+#ifdef EDF_HAVE_MMAP
+    if (map != NULL)
+    {
+        munmap(map, map_len);
+        map = NULL;
+        map_len = 0;
+    }
+#endif
+
+    if (inputfile != NULL)
+    {
+        fclose(inputfile);
+        inputfile = NULL;
+    }
+
+    nsignals = 0;
+    ndatarecords = 0;
+    edf = bdf = edfplus = bdfplus = 0;
+    annot_ch.clear();
+    annot_flag.clear();
+    label_index.clear();
+    edfparam.clear();
+    data_ch.clear();
+    col_ch.clear();
+    planned = false;
+    ranges.clear();
+    annot_ranges.clear();
+    rbuf.next_record = -1;
+    rbuf.mapped_from = -1;
+    edf_hdr.clear();
+    annots.clear();
+}
+
+inline bool EdfReader::is_annotation(int signal) const
+{
+    return annot_flag[signal] != 0;
+}
+
+inline int EdfReader::set_records(int first, int count)
+{
+    if (inputfile == NULL)
+    {
+        return fail("Error, no file opened");
+    }
+
+    if ((first < 0) || (count < 1) || (first >= ndatarecords) || (count > ndatarecords - first))
+    {
+        return fail("Error, datarecords %i to %i are outside the file, it has %i datarecords", first, first + count - 1, ndatarecords);
+    }
+
+    first_rec = first;
+    nrecs = count;
+
+    return(0);
+}
+
+inline int EdfReader::set_time_window(double start, double duration)
+{
+    double first, last;
+
+    if (inputfile == NULL)
+    {
+        return fail("Error, no file opened");
+    }
+
+    if ((start < 0.0) || (record_duration <= 0.0))
+    {
+        return fail("Error, invalid time window %f + %f seconds", start, duration);
+    }
+
+    first = floor(start / record_duration);
+
+    if (first >= ndatarecords)
+    {
+        return fail("Error, time window starts at %f seconds but the file ends at %f seconds", start, ndatarecords * record_duration);
+    }
+
+    if (duration <= 0.0)
+    {
+        return fail("Error, invalid time window %f + %f seconds", start, duration);
+    }
+
+    last = ceil((start + duration) / record_duration);
+
+    if (last > ndatarecords)
+        last = ndatarecords;
+
+    return set_records((int)first, (int)(last - first));
+}
+
+inline long long EdfReader::samples() const
+{
+    long long n = 0;
+
+    for (int c = 0; c < (int)col_ch.size(); c++)
+    {
+        n += edfparam[col_ch[c]].smp_per_record;
+    }
+
+    return n * nrecs;
+}
+
+inline std::vector<int> EdfReader::value_columns()
+{
+    std::vector<int> cols;
+
+    int c, s, spr;
+
+    plan_reads();
+
+    /* one samplerate: row by row, as decode_channels() writes them */
+    spr = common_smp_per_record();
+
+    for (s = 0; s < spr; s++)
+    {
+        for (c = 0; c < (int)col_ch.size(); c++)
+            cols.push_back(c);
+    }
+
+    for (s = 0; s < (int)schedule.size(); s++)
+        cols.push_back(schedule[s].column);
+
+    return cols;
+}
+
+inline int EdfReader::open(const char* path)
+{
+    int i, r, pathlen;
+
+    char tmp[4];
+
+    close();
+    errmsg[0] = 0;
+
+    pathlen = strlen(path);
+
+    if (pathlen < 5)
+    {
+        return fail("Error, filename must contain at least five characters.");
+    }
+
+    if ((strcmp(path + pathlen - 4, ".edf")) &&
+        (strcmp(path + pathlen - 4, ".EDF")) &&
+        (strcmp(path + pathlen - 4, ".bdf")) &&
+        (strcmp(path + pathlen - 4, ".BDF")))
+    {
+        return fail("Error, filename extension must have the form \".edf\" or \".EDF\" or \".bdf\" or \".BDF\"");
+    }
+
+    if ((!strcmp(path + pathlen - 4, ".edf")) ||
+        (!strcmp(path + pathlen - 4, ".EDF")))
+    {
+        edf = 1;
+        smpsize = 2;
+    }
+    else
+    {
+        bdf = 1;
+        smpsize = 3;
+    }
+
+    /***************** check header ******************************/
+
+    inputfile = fopen(path, "rb");
+
+    if (inputfile == NULL)
+    {
+        return fail("Error, can not open file %s for reading", path);
+    }
+
+    if (fseek(inputfile, 0xfc, SEEK_SET) || (fread(tmp, 4, 1, inputfile) != 1))
+    {
+        close();
+        return fail("Error, reading file %s", path);
+    }
+
+    nsignals = edf_field_int(tmp, 4);
+    if (nsignals < 1)
+    {
+        i = nsignals;
+        close();
+        return fail("Error, number of signals in header is %i", i);
+    }
+
+    edf_hdr.resize((size_t)(nsignals + 1) * 256);
+
+    rewind(inputfile);
+
+    if (fread(edf_hdr.data(), edf_hdr.size(), 1, inputfile) != 1)
+    {
+        close();
+        return fail("Error, reading file %s", path);
+    }
+
+    if (edf)
+    {
+        if (strncmp(edf_hdr.data(), "0       ", 8))
+        {
+            close();
+            return fail("Error, EDF-header has unknown version");
+        }
+    }
+
+    if (bdf)
+    {
+        if (strncmp(edf_hdr.data() + 1, "BIOSEMI", 7) || (edf_hdr[0] != -1))
+        {
+            close();
+            return fail("Error, BDF-header has unknown version");
+        }
+    }
+
+    ndatarecords = edf_field_int(edf_hdr.data() + 0xec, 8);
+
+    if (ndatarecords < 1)
+    {
+        i = ndatarecords;
+        close();
+        return fail("Error, number of datarecords in header is %i", i);
+    }
+
+    first_rec = 0;
+    nrecs = ndatarecords;
+
+    record_duration = edf_field_double(edf_hdr.data() + 0xf4, 8);
+
+    annot_flag.assign(nsignals, 0);
+
+    if (edf)
+    {
+        edfplus = !strncmp(edf_hdr.data() + 0xc0, "EDF+C     ", 10) || !strncmp(edf_hdr.data() + 0xc0, "EDF+D     ", 10);
+    }
+    else
+    {
+        bdfplus = !strncmp(edf_hdr.data() + 0xc0, "BDF+C     ", 10) || !strncmp(edf_hdr.data() + 0xc0, "BDF+D     ", 10);
+    }
+
+    if (edfplus || bdfplus)
+    {
+        for (i = 0; i < nsignals; i++)
+        {
+            if (!(strncmp(edf_hdr.data() + 256 + i * 16, edfplus ? "EDF Annotations " : "BDF Annotations ", 16)))
+            {
+                annot_ch.push_back(i);
+                annot_flag[i] = 1;
+            }
+        }
+
+        if (annot_ch.empty())
+        {
+            close();
+            return fail("Error, file is marked as %s but it has no annotationsignal.", edf ? "EDF+" : "BDF+");
+        }
+    }
+
+    edfparam.resize(nsignals);
+
+    recordsize = 0;
+
+    for (i = 0; i < nsignals; i++)
+    {
+        edfparam[i].smp_per_record = edf_field_int(edf_hdr.data() + 256 + nsignals * 216 + i * 8, 8);
+        edfparam[i].smp_written = 0;
+        edfparam[i].buf_offset = recordsize;
+
+        /* offsets inside a datarecord are int, positions in the file 64-bit */
+        if ((edfparam[i].smp_per_record < 0) || (((long long)recordsize + edfparam[i].smp_per_record) * smpsize > INT_MAX))
+        {
+            close();
+            return fail("Error, datarecords larger than %i bytes are not supported", INT_MAX);
+        }
+
+        recordsize += edfparam[i].smp_per_record;
+
+        edfparam[i].phys_min = edf_field_double(edf_hdr.data() + 256 + nsignals * 104 + i * 8, 8);
+        edfparam[i].phys_max = edf_field_double(edf_hdr.data() + 256 + nsignals * 112 + i * 8, 8);
+        edfparam[i].dig_min = edf_field_int(edf_hdr.data() + 256 + nsignals * 120 + i * 8, 8);
+        edfparam[i].dig_max = edf_field_int(edf_hdr.data() + 256 + nsignals * 128 + i * 8, 8);
+
+        edfparam[i].time_step = record_duration / edfparam[i].smp_per_record;
+        edfparam[i].sense = (edfparam[i].phys_max - edfparam[i].phys_min) / (edfparam[i].dig_max - edfparam[i].dig_min);
+        edfparam[i].offset = edfparam[i].phys_max / edfparam[i].sense - edfparam[i].dig_max;
+    }
+
+    for (i = 0; i < nsignals; i++)
+    {
+        if (!is_annotation(i))
+            data_ch.push_back(i);
+
+        for (r = 16; (r > 0) && (edf_hdr[256 + i * 16 + r - 1] == ' '); r--);
+
+        label_index.emplace(std::string(edf_hdr.data() + 256 + i * 16, r), i);
+    }
+
+    col_ch = data_ch;
+    planned = false;
+
+    map_file();
+
+    max_tal_ln = 0;
+    for (r = 0; r < (int)annot_ch.size(); r++)
+    {
+        if (max_tal_ln < edfparam[annot_ch[r]].smp_per_record * smpsize)
+            max_tal_ln = edfparam[annot_ch[r]].smp_per_record * smpsize;
+    }
+
+    if (max_tal_ln < 128)
+        max_tal_ln = 128;
+
+    scratchpad.resize(max_tal_ln + 3);
+    duration_in_txt.resize(max_tal_ln + 3);
+    time_in_txt.resize(max_tal_ln + 3);
+
+    return(0);
+}
+
+/* maps header and datarecords read-only; on any failure the buffered path is used */
+inline void EdfReader::map_file()
+{
+#ifdef EDF_HAVE_MMAP
+    struct stat st;
+
+    void* p;
+
+    long long len = record_pos(ndatarecords);
+
+    if (!use_mmap || ((long long)(size_t)len != len))
+        return;
+
+    /* a truncated file is left to the buffered path, which reports the short read */
+    if (fstat(fileno(inputfile), &st) || !S_ISREG(st.st_mode) || ((long long)st.st_size < len))
+        return;
+
+    p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fileno(inputfile), 0);
+    if (p == MAP_FAILED)
+        return;
+
+    madvise(p, len, MADV_SEQUENTIAL);
+
+    map = p;
+    map_len = len;
+#endif
+}
+
+inline int EdfReader::find_signal(const char* label) const
+{
+    int len;
+
+    len = strlen(label);
+    while ((len > 0) && (label[len - 1] == ' '))
+        len--;
+
+    auto it = label_index.find(std::string(label, len));
+
+    return it == label_index.end() ? -1 : it->second;
+}
+
+inline int EdfReader::select_signals(const std::vector<int>& signals)
+{
+    int c;
+
+    if (inputfile == NULL)
+    {
+        return fail("Error, no file opened");
+    }
+
+    for (c = 0; c < (int)signals.size(); c++)
+    {
+        if ((signals[c] < 0) || (signals[c] >= nsignals))
+        {
+            return fail("Error, signal %i does not exist, the file has %i signals", signals[c] + 1, nsignals);
+        }
+
+        if (is_annotation(signals[c]))
+        {
+            return fail("Error, signal %i is an annotation signal", signals[c] + 1);
+        }
+    }
+
+    col_ch = signals.empty() ? data_ch : signals;
+    planned = false;
+
+    return(0);
+}
+
+inline int EdfReader::select_signals(const std::vector<std::string>& labels)
+{
+    std::vector<int> signals;
+
+    int c, j;
+
+    if (inputfile == NULL)
+    {
+        return fail("Error, no file opened");
+    }
+
+    for (c = 0; c < (int)labels.size(); c++)
+    {
+        j = find_signal(labels[c].c_str());
+        if (j < 0)
+        {
+            return fail("Error, there is no signal with label \"%s\"", labels[c].c_str());
+        }
+
+        signals.push_back(j);
+    }
+
+    return select_signals(signals);
+}
+
+/* the byte ranges of these signals in a datarecord, adjacent ones merged */
+inline std::vector<EdfReader::byterange> EdfReader::signal_ranges(const std::vector<int>& signals) const
+{
+    std::vector<char> wanted(nsignals, 0);
+
+    std::vector<byterange> rngs;
+
+    int c, j;
+
+    for (c = 0; c < (int)signals.size(); c++)
+        wanted[signals[c]] = 1;
+
+    for (j = 0; j < nsignals; j++)
+    {
+        if (!wanted[j])
+            continue;
+
+        if (!rngs.empty() && (rngs.back().offset + rngs.back().len == edfparam[j].buf_offset * smpsize))
+            rngs.back().len += edfparam[j].smp_per_record * smpsize;
+        else
+            rngs.push_back({ edfparam[j].buf_offset * smpsize, edfparam[j].smp_per_record * smpsize });
+    }
+
+    return rngs;
+}
+
+/* Works out which parts of a datarecord the reads of the current       */
+/* selection need. When the selected signals make up less than half of  */
+/* the record only their byte ranges are read on the buffered path, and */
+/* a mapping is told not to read ahead. With mixed samplerates the      */
+/* output order of a datarecord is worked out too (see                  */
+/* decode_interleaved()). All of it is kept until the selection changes. */
+inline void EdfReader::plan_reads()
+{
+    int r, c, s, needed = 0;
+
+    if (planned)
+        return;
+
+    planned = true;
+
+    annot_ranges = signal_ranges(annot_ch);
+
+    ranges = signal_ranges(col_ch);
+
+    for (r = 0; r < (int)ranges.size(); r++)
+        needed += ranges[r].len;
+
+    if (needed * 2 >= recordsize * smpsize)
+        ranges.clear();
+
+#ifdef EDF_HAVE_MMAP
+    if (map != NULL)
+        madvise(map, map_len, ranges.empty() ? MADV_SEQUENTIAL : MADV_RANDOM);
+#endif
+
+    schedule.clear();
+    col_offset.resize(col_ch.size());
+    col_sense.resize(col_ch.size());
+
+    for (c = 0; c < (int)col_ch.size(); c++)
+    {
+        col_offset[c] = edfparam[col_ch[c]].offset;
+        col_sense[c] = edfparam[col_ch[c]].sense;
+    }
+
+    if (common_smp_per_record())
+        return;
+
+    /* Sample s of a signal with n samples per record lies at s / n of the  */
+    /* record; comparing these fractions crosswise in integers gives the    */
+    /* exact order, samples at the same time following the column order.   */
+    for (c = 0; c < (int)col_ch.size(); c++)
+    {
+        for (s = 0; s < edfparam[col_ch[c]].smp_per_record; s++)
+            schedule.push_back({ s, c });
+    }
+
+    std::stable_sort(schedule.begin(), schedule.end(), [this](const gather& a, const gather& b)
+    {
+        /* a datarecord of no duration has all its samples at the same time */
+        if (record_duration <= 0.0)
+            return a.sample < b.sample;
+
+        return (long long)a.sample * edfparam[col_ch[b.column]].smp_per_record
+            < (long long)b.sample * edfparam[col_ch[a.column]].smp_per_record;
+    });
+
+    for (s = 0; s < (int)schedule.size(); s++)
+        schedule[s].sample += edfparam[col_ch[schedule[s].column]].buf_offset;
+}
+
+/* position of a datarecord in the file */
+inline long long EdfReader::record_pos(int record) const
+{
+    return (long long)(nsignals + 1) * 256 + (long long)record * recordsize * smpsize;
+}
+
+inline int EdfReader::read_at(char* dst, size_t len, long long pos)
+{
+#ifdef EDF_HAVE_MMAP
+    ssize_t n;
+
+    /* a 32-bit off_t (no _FILE_OFFSET_BITS=64) can not reach past 2 GB */
+    if ((long long)(off_t)(pos + len) != (long long)(pos + len))
+        return(1);
+
+    while (len > 0)
+    {
+        n = pread(fileno(inputfile), dst, len, pos);
+        if (n <= 0)
+            return(1);
+
+        dst += n;
+        len -= n;
+        pos += n;
+    }
+
+    return(0);
+#else
+    if (edf_fseek(inputfile, pos) || (fread(dst, len, 1, inputfile) != 1))
+        return(1);
+
+    return(0);
+#endif
+}
+
+/* points buf at the bytes of one datarecord, of which at least rngs (all if empty) are valid */
+inline int EdfReader::load_record(int record, const std::vector<byterange>& rngs, recordbuf& rb, const char** buf)
+{
+    long long pos = record_pos(record);
+
+    pipeline* pipe = rb.pipe.get();
+
+    int k;
+
+    if (pipe != NULL)
+    {
+        /* datarecords are taken in order, so a new buffer frees the previous one */
+        k = (record - pipe->first) / pipe->chunk;
+
+        if (k != pipe->current)
+        {
+            pipe->publish(pipe->consumed, k);
+            pipe->current = k;
+
+            pipe->wait([pipe, k]() { return pipe->filled.load(std::memory_order_acquire) > k; });
+        }
+
+        if (pipe->failed.load(std::memory_order_relaxed) == k)
+            return(1);
+
+        *buf = pipe->ring.data() + (k % pipe->nbuf) * pipe->chunk_bytes
+            + (size_t)((record - pipe->first) % pipe->chunk) * recordsize * smpsize;
+        return(0);
+    }
+
+    if (map != NULL)
+    {
+        *buf = (const char*)map + pos;
+        release_mapped(rb, pos);
+        return(0);
+    }
+
+    if (rb.data.size() < (size_t)recordsize * smpsize)
+        rb.data.resize((size_t)recordsize * smpsize);
+
+    *buf = rb.data.data();
+
+    if (!rngs.empty())
+    {
+        rb.next_record = -1;
+
+        for (int r = 0; r < (int)rngs.size(); r++)
+        {
+            if (read_at(rb.data.data() + rngs[r].offset, rngs[r].len, pos + rngs[r].offset))
+                return fail("Error when reading inputfile during conversion");
+        }
+
+        return(0);
+    }
+
+#ifdef EDF_HAVE_MMAP
+    if (read_at(rb.data.data(), recordsize * smpsize, pos))
+        return fail("Error when reading inputfile during conversion");
+#else
+    if (record != rb.next_record)
+    {
+        if (edf_fseek(inputfile, pos))
+        {
+            rb.next_record = -1;
+            return fail("Error when reading inputfile");
+        }
+    }
+
+    if (fread(rb.data.data(), recordsize * smpsize, 1, inputfile) != 1)
+    {
+        rb.next_record = -1;
+        return fail("Error when reading inputfile during conversion");
+    }
+
+    rb.next_record = record + 1;
+#endif
+
+    return(0);
+}
+
+/* Drops the mapped pages before pos, which the decoder is done with, from */
+/* the resident set a few MB at a time, so that a decode does not hold the */
+/* whole file in memory next to its output. The pages stay in the page    */
+/* cache and are mapped again without I/O when they are needed again.     */
+inline void EdfReader::release_mapped(recordbuf& rb, long long pos)
+{
+#ifdef EDF_HAVE_MMAP
+    static const long long page = sysconf(_SC_PAGESIZE);
+
+    long long end = pos & ~(page - 1);
+
+    if ((rb.mapped_from < 0) || (end < rb.mapped_from))
+    {
+        rb.mapped_from = end;
+        return;
+    }
+
+    if (end - rb.mapped_from < (4 << 20))
+        return;
+
+    madvise((char*)map + rb.mapped_from, end - rb.mapped_from, MADV_DONTNEED);
+
+    rb.mapped_from = end;
+#else
+    (void)rb;
+    (void)pos;
+#endif
+}
+
+/* Asks the kernel to read the pages holding rngs of datarecords first to */
+/* first + count - 1 into the page cache, without waiting for them. Ranges */
+/* that share or touch a page go out as one request, so small datarecords  */
+/* take one madvise() for many of them.                                    */
+inline void EdfReader::prefetch_mapped(int first, int count, const std::vector<byterange>& rngs)
+{
+#ifdef EDF_HAVE_MMAP
+    static const long long page = sysconf(_SC_PAGESIZE);
+
+    long long from = -1,
+        to = -1,
+        a, b;
+
+    int i, r;
+
+    for (i = first; i < first + count; i++)
+    {
+        for (r = 0; r < (int)rngs.size(); r++)
+        {
+            a = (record_pos(i) + rngs[r].offset) & ~(page - 1);
+            b = record_pos(i) + rngs[r].offset + rngs[r].len;
+
+            if ((from >= 0) && (a <= to))
+            {
+                to = b;
+                continue;
+            }
+
+            if (from >= 0)
+                madvise((char*)map + from, to - from, MADV_WILLNEED);
+
+            from = a;
+            to = b;
+        }
+    }
+
+    if (from >= 0)
+        madvise((char*)map + from, to - from, MADV_WILLNEED);
+#else
+    (void)first;
+    (void)count;
+    (void)rngs;
+#endif
+}
+
+/* lets an I/O thread read datarecords first to first + count - 1 ahead into rb */
+inline void EdfReader::start_pipeline(recordbuf& rb, int first, int count, const std::vector<byterange>& rngs)
+{
+    pipeline* pipe;
+
+    size_t record_bytes = (size_t)recordsize * smpsize;
+
+    if ((pipe_buffers <= 0) || (count <= 0))
+        return;
+
+    rb.pipe.reset(pipe = new pipeline);
+
+    pipe->nbuf = pipe_buffers;
+    pipe->chunk = pipe_size / record_bytes;
+    if (pipe->chunk < 1)
+        pipe->chunk = 1;
+    if (pipe->chunk > count)
+        pipe->chunk = count;
+    pipe->chunk_bytes = pipe->chunk * record_bytes;
+    pipe->first = first;
+    pipe->count = count;
+    pipe->ring.resize(pipe->nbuf * pipe->chunk_bytes);
+
+    pipe->io = std::thread(&EdfReader::fill_pipeline, this, pipe, &rngs);
+}
+
+/* the I/O thread of a pipeline */
+inline void EdfReader::fill_pipeline(pipeline* pipe, const std::vector<byterange>* rngs)
+{
+    size_t record_bytes = (size_t)recordsize * smpsize;
+
+    long long pos;
+
+    char* dst;
+
+    int k, i, r, n, err;
+
+    if ((uring_depth > 0) && !fill_pipeline_uring(pipe, rngs))
+        return;
+
+    for (k = 0; k * pipe->chunk < pipe->count; k++)
+    {
+        /* wait until the decoder has left the buffer that is overwritten next */
+        pipe->wait([pipe, k]() { return k - pipe->consumed.load(std::memory_order_acquire) < pipe->nbuf; });
+        if (pipe->stop)
+            return;
+
+        dst = pipe->ring.data() + (k % pipe->nbuf) * pipe->chunk_bytes;
+        n = pipe->count - k * pipe->chunk;
+        if (n > pipe->chunk)
+            n = pipe->chunk;
+        pos = record_pos(pipe->first + k * pipe->chunk);
+
+        if (rngs->empty())
+        {
+            err = read_at(dst, n * record_bytes, pos);
+        }
+        else
+        {
+            /* only the selected signals, but still one buffer ahead */
+            for (err = 0, i = 0; (i < n) && !err; i++)
+            {
+                for (r = 0; (r < (int)rngs->size()) && !err; r++)
+                    err = read_at(dst + i * record_bytes + (*rngs)[r].offset, (*rngs)[r].len, pos + i * record_bytes + (*rngs)[r].offset);
+            }
+        }
+
+        if (err)
+        {
+            fail("Error when reading inputfile during conversion");
+            pipe->failed.store(k, std::memory_order_relaxed);
+            pipe->publish(pipe->filled, k + 1);
+            return;
+        }
+
+        pipe->publish(pipe->filled, k + 1);
+    }
+}
+
+/* The io_uring I/O thread of a pipeline. Every buffer of the ring is split */
+/* into reads of at most 1 MB (one per selected byte range when signals    */
+/* are selected) and up to uring_depth of them are kept in flight. Buffers */
+/* go to the decoder in order, once all of their reads are done. Returns 1 */
+/* when io_uring is not available, before anything is read.                */
+inline int EdfReader::fill_pipeline_uring(pipeline* pipe, const std::vector<byterange>* rngs)
+{
+#ifdef EDF_HAVE_IO_URING
+    struct request
+    {
+        char* dst;
+        unsigned len;
+        long long pos;
+        int k;
+    };
+
+    const size_t piece = 1 << 20,
+        record_bytes = (size_t)recordsize * smpsize;
+
+    edf_uring ring;
+
+    std::vector<request> req;
+
+    std::vector<int> free_req,
+        pending(pipe->nbuf);
+
+    unsigned long long tag;
+
+    size_t part = 0,
+        parts,
+        bytes;
+
+    long long pos;
+
+    char* dst;
+
+    int fd = fileno(inputfile),
+        nchunks = (pipe->count + pipe->chunk - 1) / pipe->chunk,
+        issued = 0,
+        done = 0,
+        inflight = 0,
+        failed = -1,
+        i, r, n, res;
+
+    if (edf_uring_init(&ring, uring_depth))
+        return(1);
+
+    /* reads into registered memory skip pinning the pages, but work without it too */
+    if (pipe->ring.size() <= (1u << 30))
+        edf_uring_register(&ring, pipe->ring.data(), pipe->ring.size());
+
+    req.resize(ring.entries);
+    for (i = (uring_depth < (int)ring.entries ? uring_depth : ring.entries) - 1; i >= 0; i--)
+        free_req.push_back(i);
+
+    while (done < nchunks)
+    {
+        /* queue the reads of the buffers that the decoder has left */
+        while ((failed < 0) && !pipe->stop && !free_req.empty() && (issued < nchunks)
+            && (issued - pipe->consumed.load(std::memory_order_acquire) < pipe->nbuf))
+        {
+            n = pipe->count - issued * pipe->chunk;
+            if (n > pipe->chunk)
+                n = pipe->chunk;
+            dst = pipe->ring.data() + (issued % pipe->nbuf) * pipe->chunk_bytes;
+            pos = record_pos(pipe->first + issued * pipe->chunk);
+
+            if (rngs->empty())
+            {
+                bytes = n * record_bytes;
+                parts = (bytes + piece - 1) / piece;
+                dst += part * piece;
+                pos += part * piece;
+                bytes -= part * piece;
+                if (bytes > piece)
+                    bytes = piece;
+            }
+            else
+            {
+                parts = n * rngs->size();
+                i = part / rngs->size();
+                r = part % rngs->size();
+                dst += i * record_bytes + (*rngs)[r].offset;
+                pos += i * record_bytes + (*rngs)[r].offset;
+                bytes = (*rngs)[r].len;
+            }
+
+            i = free_req.back();
+            free_req.pop_back();
+            req[i] = { dst, (unsigned)bytes, pos, issued };
+
+            edf_uring_read(&ring, fd, dst, bytes, pos, i);
+            pending[issued % pipe->nbuf]++;
+            inflight++;
+
+            if (++part == parts)
+            {
+                part = 0;
+                issued++;
+            }
+        }
+
+        if (inflight == 0)
+        {
+            if ((failed >= 0) || pipe->stop)
+                break;
+
+            /* every buffer is full, wait for the decoder */
+            pipe->wait([pipe, issued, nchunks]() { return (issued >= nchunks) || (issued - pipe->consumed.load(std::memory_order_acquire) < pipe->nbuf); });
+            continue;
+        }
+
+        if (edf_uring_submit(&ring, 1))
+        {
+            if ((errno == EAGAIN) || (errno == EINTR))
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            /* The kernel takes no more reads. The ones it has are still */
+            /* reading into the ring, which goes when this thread ends:  */
+            /* wait until they have all finished; the queued ones never  */
+            /* started.                                                  */
+            if ((failed < 0) || (done < failed))
+                failed = done;
+
+            inflight -= (int)ring.queued;
+            while (inflight > 0)
+            {
+                if (edf_uring_wait(&ring, 1))
+                    std::this_thread::yield();
+
+                while (edf_uring_reap(&ring, &tag, &res))
+                    inflight--;
+            }
+            break;
+        }
+
+        while (edf_uring_reap(&ring, &tag, &res))
+        {
+            request& q = req[tag];
+
+            /* a short read, queue the rest */
+            if ((res > 0) && ((unsigned)res < q.len))
+            {
+                q.dst += res;
+                q.len -= res;
+                q.pos += res;
+                edf_uring_read(&ring, fd, q.dst, q.len, q.pos, tag);
+                continue;
+            }
+
+            if ((res <= 0) && ((failed < 0) || (q.k < failed)))
+                failed = q.k;
+
+            pending[q.k % pipe->nbuf]--;
+            inflight--;
+            free_req.push_back(tag);
+        }
+
+        while ((done < issued) && !pending[done % pipe->nbuf] && ((failed < 0) || (done < failed)))
+            pipe->publish(pipe->filled, ++done);
+    }
+
+    edf_uring_exit(&ring);
+
+    if (failed >= 0)
+    {
+        fail("Error when reading inputfile during conversion");
+        pipe->failed.store(failed, std::memory_order_relaxed);
+        pipe->publish(pipe->filled, failed + 1);
+    }
+
+    return(0);
+#else
+    (void)pipe;
+    (void)rngs;
+
+    return(1);
+#endif
+}
+
+/* Calls job(first, count, buffer) for consecutive slices of the selected */
+/* datarecords, each slice on its own thread when more than one is set.    */
+template<typename Job>
+int EdfReader::for_records(Job job)
+{
+    std::vector<std::thread> pool;
+
+    std::vector<int> err;
+
+    int t, n = nthreads;
+
+#ifndef EDF_HAVE_MMAP
+    if (map == NULL)
+        n = 1;  /* without pread the buffered path shares one file position */
+#endif
+
+    if (n > nrecs)
+        n = nrecs;
+
+    if (n <= 1)
+    {
+        start_pipeline(rbuf, first_rec, nrecs, ranges);
+
+        t = job(first_rec, nrecs, rbuf);
+
+        rbuf.pipe.reset();
+
+        return t;
+    }
+
+    err.resize(n);
+
+    for (t = 0; t < n; t++)
+    {
+        int first = first_rec + (int)((long long)nrecs * t / n),
+            last = first_rec + (int)((long long)nrecs * (t + 1) / n);
+
+        pool.emplace_back([this, &job, &err, t, first, last]
+        {
+            recordbuf rb;
+
+            start_pipeline(rb, first, last - first, ranges);
+
+            err[t] = job(first, last - first, rb);
+        });
+    }
+
+    for (t = 0; t < n; t++)
+        pool[t].join();
+
+    for (t = 0; t < n; t++)
+    {
+        if (err[t])
+            return(1);
+    }
+
+    return(0);
+}
+
+/* passes the annotations of the selected datarecords on, in order */
+inline int EdfReader::scan_annotations()
+{
+    const char* rec = NULL;
+
+    const int prefetch = 256;
+
+    int i, err = 0;
+
+    collecting = store_annotations;
+
+    if (collecting && !appending)
+        annots.clear();
+
+    if (!(edfplus || bdfplus) || ((annotationfile == NULL) && !collecting))
+        return(0);
+
+    start_pipeline(rbuf, first_rec, nrecs, annot_ranges);
+
+    for (i = first_rec; (i < first_rec + nrecs) && !err; i++)
+    {
+        /* only the annotation signals are wanted: keep the pages of the */
+        /* next batch of datarecords coming while this one is parsed     */
+        if (annotations_only && (map != NULL) && (rbuf.pipe == NULL) && ((i - first_rec) % prefetch == 0))
+        {
+            if (i == first_rec)
+                prefetch_mapped(i, std::min(prefetch, first_rec + nrecs - i), annot_ranges);
+
+            if (i + prefetch < first_rec + nrecs)
+                prefetch_mapped(i + prefetch, std::min(prefetch, first_rec + nrecs - i - prefetch), annot_ranges);
+        }
+
+        err = load_record(i, annot_ranges, rbuf, &rec) || process_annotations(i, rec);
+    }
+
+    rbuf.pipe.reset();
+
+    annots.sort();
+
+    return err;
+}
+
+inline int EdfReader::read_annotations()
+{
+    bool keep = store_annotations;
+
+    int err;
+
+    if (inputfile == NULL)
+    {
+        return fail("Error, no file opened");
+    }
+
+    plan_reads();
+
+    /* Only the bytes of the annotation signals are read: mapped, the  */
+    /* readahead that would bring in the samples around them is turned */
+    /* off and their own pages are asked for a batch ahead; otherwise  */
+    /* they are read with one pread() per datarecord and signal.       */
+#ifdef EDF_HAVE_MMAP
+    if (map != NULL)
+        madvise(map, map_len, MADV_RANDOM);
+#endif
+
+    store_annotations = true;
+    annotations_only = true;
+    err = scan_annotations();
+    annotations_only = false;
+    store_annotations = keep;
+
+#ifdef EDF_HAVE_MMAP
+    if (map != NULL)
+        madvise(map, map_len, ranges.empty() ? MADV_SEQUENTIAL : MADV_RANDOM);
+#endif
+
+    return err;
+}
+
+/* extracts the timekeeping TAL of a datarecord and passes the annotations on */
+inline int EdfReader::process_annotations(int record, const char* buf)
+{
+    int r, m, n,
+        onset,
+        duration,
+        spr;
+
+    double t;
+
+    const char* s,
+        * d,
+        * z,
+        * end;
+
+    char* pad = scratchpad.data();
+
+    /* extract time from datarecord */
+
+    s = buf + edfparam[annot_ch[0]].buf_offset * smpsize;
+    end = s + edfparam[annot_ch[0]].smp_per_record * smpsize;
+    d = (const char*)memchr(s, 20, end - s);
+    n = (int)(((d != NULL) ? d : end) - s);
+    memcpy(pad, s, n);
+    pad[n] = 0;
+    elapsedtime = atof(pad);
+
+    if ((annotationfile == NULL) && !collecting)
+        return(0);
+
+    spr = col_ch.empty() || (record_duration <= 0.0) ? 0 : edfparam[col_ch[0]].smp_per_record;
+
+    /* process annotations */
+
+    for (r = 0; r < (int)annot_ch.size(); r++)
+    {
+        s = buf + edfparam[annot_ch[r]].buf_offset * smpsize;
+        end = s + edfparam[annot_ch[r]].smp_per_record * smpsize;
+
+        /* every TAL ends with a 0, which also resets the parser */
+        for (s = edf_skip_zeros(s, end); s < end; s = edf_skip_zeros(s, end))
+        {
+            onset = 0;
+            duration = 0;
+            time_in_txt[0] = 0;
+            duration_in_txt[0] = 0;
+
+            for (; s < end; s = d + 1)
+            {
+                d = edf_tal_delimiter(s, end);
+                if (d == end)
+                {
+                    s = end;
+                    break;
+                }
+
+                /* an unterminated field runs into the 0 that ends the TAL */
+                z = (const char*)memchr(s, 0, d - s);
+                if (z != NULL)
+                {
+                    s = z;
+                    break;
+                }
+
+                n = (int)(d - s);
+                memcpy(pad, s, n);
+                pad[n] = 0;
+
+                if (*d == 21)
+                {
+                    if (!onset)
+                    {
+                        memcpy(time_in_txt.data(), pad, n + 1);
+                        onset = 1;
+                    }
+                    duration = 1;
+                    duration_in_txt[0] = 0;
+                }
+                else if (duration)
+                {
+                    memcpy(duration_in_txt.data(), pad, n + 1);
+                    duration = 0;
+                }
+                else if (onset)
+                {
+                    if (n && collecting)
+                    {
+                        t = atof(time_in_txt.data());
+                        annots.add(t, duration_in_txt[0] ? atof(duration_in_txt.data()) : -1.0, pad, n, record,
+                            spr ? (long long)record * spr + llround((t - elapsedtime) * spr / record_duration) : -1);
+                    }
+                    if (n && (annotationfile != NULL))
+                    {
+                        utf8_to_latin1(pad);
+                        for (m = 0; m < n; m++)
+                        {
+                            if (pad[m] == 0)
+                            {
+                                break;
+                            }
+
+                            if ((((unsigned char*)pad)[m] < 32) || (((unsigned char*)pad)[m] == ','))
+                            {
+                                pad[m] = '.';
+                            }
+                        }
+                        fprintf(annotationfile, "%s,%s,%s\n", time_in_txt.data(), duration_in_txt.data(), pad);
+                    }
+                    duration_in_txt[0] = 0;
+                }
+                else
+                {
+                    memcpy(time_in_txt.data(), pad, n + 1);
+                    onset = 1;
+                    duration_in_txt[0] = 0;
+                }
+            }
+        }
+    }
+
+    return(0);
+}
+
+template<typename Scalar>
+int EdfReader::read(Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& mat)
+{
+    if (inputfile == NULL)
+    {
+        return fail("Error, no file opened");
+    }
+
+    mat.resize(samples(), 1);
+
+    return read_into(mat.data(), mat.size());
+}
+
+template<typename Scalar>
+int EdfReader::read_into(Scalar* out, long long n)
+{
+    if (inputfile == NULL)
+    {
+        return fail("Error, no file opened");
+    }
+
+    if (n != samples())
+    {
+        return fail("Error, the output has room for %lli samples, the selection has %lli", n, samples());
+    }
+
+    plan_reads();
+
+    if (scan_annotations())
+        return(1);
+
+    /* with one samplerate the output order is simply row by row */
+    if (common_smp_per_record())
+    {
+        return decode_channels(out, n / col_ch.size(), col_ch.size(), 1);
+    }
+
+    if (bdf)
+        return decode_interleaved<true>(out);
+
+    return decode_interleaved<false>(out);
+}
+
+inline Eigen::MatrixXd EdfReader::read()
+{
+    Eigen::MatrixXd mat;
+
+    if (read(mat))
+        mat.resize(0, 0);
+
+    return mat;
+}
+
+/* smp_per_record shared by all data signals, 0 if they differ */
+inline int EdfReader::common_smp_per_record() const
+{
+    int c, spr;
+
+    if (col_ch.empty())
+        return(0);
+
+    spr = edfparam[col_ch[0]].smp_per_record;
+
+    for (c = 1; c < (int)col_ch.size(); c++)
+    {
+        if (edfparam[col_ch[c]].smp_per_record != spr)
+            return(0);
+    }
+
+    return spr;
+}
+
+/* Merges signals with different samplerates sample by sample in time   */
+/* order. The order is the same for every datarecord, so plan_reads()   */
+/* works it out once as a table of sample positions, which is gathered  */
+/* record after record.                                                 */
+template<bool Bdf, typename Scalar>
+int EdfReader::decode_interleaved(Scalar* out)
+{
+    const long long per_record = samples() / nrecs;
+
+    return for_records([&](int first, int count, recordbuf& rb)
+    {
+        int i, k;
+
+        const gather* g;
+
+        const char* rec = NULL;
+
+        Scalar* val = out + (first - first_rec) * per_record;
+
+        for (i = first; i < first + count; i++)
+        {
+            if (load_record(i, ranges, rb, &rec))
+                return(1);
+
+            for (k = 0, g = schedule.data(); k < (int)schedule.size(); k++, g++)
+                *val++ = (Scalar)((edf_digital_sample<Bdf>(rec, g->sample) + col_offset[g->column]) * col_sense[g->column]);
+        }
+
+        return(0);
+    });
+}
+
+/* writes sample s of column c to out[s * rs + c * cs] */
+template<typename Scalar>
+int EdfReader::decode_channels(Scalar* out, Eigen::Index rows, Eigen::Index rs, Eigen::Index cs)
+{
+    if (bdf)
+        return decode_channels_as<true>(out, rows, rs, cs);
+
+    return decode_channels_as<false>(out, rows, rs, cs);
+}
+
+/* decode_channels() for one sample format, so the format is not tested per block */
+template<bool Bdf, typename Scalar>
+int EdfReader::decode_channels_as(Scalar* out, Eigen::Index rows, Eigen::Index rs, Eigen::Index cs)
+{
+    const int spr = (int)(rows / nrecs);
+
+    return for_records([&](int first, int count, recordbuf& rb)
+    {
+        int i, c;
+
+        const edfparamblock* param;
+
+        const char* rec = NULL;
+
+        for (i = first; i < first + count; i++)
+        {
+            if (load_record(i, ranges, rb, &rec))
+                return(1);
+
+            for (c = 0; c < (int)col_ch.size(); c++)
+            {
+                param = &edfparam[col_ch[c]];
+
+                edf_convert_block<Bdf>(rec + param->buf_offset * (Bdf ? 3 : 2), spr, param->offset, param->sense,
+                    out + (Eigen::Index)(i - first_rec) * spr * rs + c * cs, rs);
+            }
+        }
+
+        return(0);
+    });
+}
+
+/* the number of rows of read_channels(), fails on mixed samplerates */
+inline int EdfReader::channel_rows(Eigen::Index* rows)
+{
+    int c, spr;
+
+    if (inputfile == NULL)
+    {
+        return fail("Error, no file opened");
+    }
+
+    if (col_ch.empty())
+    {
+        return fail("Error, file has no data signals");
+    }
+
+    spr = edfparam[col_ch[0]].smp_per_record;
+
+    for (c = 1; c < (int)col_ch.size(); c++)
+    {
+        if (edfparam[col_ch[c]].smp_per_record != spr)
+        {
+            return fail("Error, signal %i has %i samples per record while signal %i has %i, use read() for mixed samplerates",
+                col_ch[c] + 1, edfparam[col_ch[c]].smp_per_record, col_ch[0] + 1, spr);
+        }
+    }
+
+    *rows = (Eigen::Index)nrecs * spr;
+
+    return(0);
+}
+
+template<typename Scalar, int Options>
+int EdfReader::read_channels(Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Options>& mat)
+{
+    Eigen::Index rows = 0;
+
+    if (channel_rows(&rows))
+        return(1);
+
+    mat.resize(rows, col_ch.size());
+
+    return read_channels_into(mat.data(), mat.rows(), mat.cols(), mat.rowStride(), mat.colStride());
+}
+
+template<typename Scalar>
+int EdfReader::read_channels_into(Scalar* out, Eigen::Index rows, Eigen::Index cols, Eigen::Index row_stride, Eigen::Index col_stride)
+{
+    Eigen::Index needed = 0;
+
+    if (channel_rows(&needed))
+        return(1);
+
+    if ((rows != needed) || (cols != (Eigen::Index)col_ch.size()))
+    {
+        return fail("Error, the output is %lli x %lli, the selection needs %lli x %i", (long long)rows, (long long)cols, (long long)needed, (int)col_ch.size());
+    }
+
+    plan_reads();
+
+    if (scan_annotations())
+        return(1);
+
+    return decode_channels(out, rows, row_stride, col_stride);
+}
+
+template<typename Derived>
+int EdfReader::read_channels_into(Eigen::MatrixBase<Derived>& out)
+{
+    static_assert(Derived::Flags & Eigen::DirectAccessBit, "read_channels_into() needs an expression with direct access to its memory");
+
+    return read_channels_into(out.derived().data(), out.rows(), out.cols(), out.rowStride(), out.colStride());
+}
+
+/* feeds the selection to a sink, records_per_block datarecords at a time */
+template<typename Scalar>
+int EdfReader::read_blocks(EdfSink<Scalar>& sink, bool channels, int records_per_block)
+{
+    const int first = first_rec,
+        count = nrecs;
+
+    Eigen::Index rows = 0, cols = 1;
+
+    long long per_record;
+
+    int r, n, err = 0;
+
+    if (inputfile == NULL)
+    {
+        return fail("Error, no file opened");
+    }
+
+    if (channels)
+    {
+        if (channel_rows(&rows))
+            return(1);
+
+        cols = col_ch.size();
+    }
+    else rows = samples();
+
+    per_record = count ? rows / count : 0;
+
+    if ((records_per_block <= 0) || (records_per_block > count))
+        records_per_block = count;
+
+    if (sink.begin(rows, cols))
+    {
+        return fail("%s", sink.error());
+    }
+
+    for (r = 0; (r < count) && !err; r += n)
+    {
+        n = std::min(records_per_block, count - r);
+
+        if (n < count)
+            set_records(first + r, n);
+
+        typename EdfSink<Scalar>::block_type block = sink.block(r * per_record, n * per_record, cols);
+
+        if ((block.rows() != n * per_record) || (block.cols() != cols) || (!channels && (block.rowStride() != 1)))
+            err = fail("%s", *sink.error() ? sink.error() : "Error, the sink gave no room for the samples");
+        else if (channels ? read_channels_into(block.data(), block.rows(), block.cols(), block.rowStride(), block.colStride())
+            : read_into(block.data(), block.size()))
+            err = 1;
+        else if (sink.write(block, r * per_record))
+            err = fail("%s", sink.error());
+
+        /* the annotations of all blocks together */
+        appending = true;
+    }
+
+    appending = false;
+
+    first_rec = first;
+    nrecs = count;
+
+    if (!err && sink.end())
+    {
+        return fail("%s", sink.error());
+    }
+
+    return err;
+}
+
+#endif
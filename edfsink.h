@@ -0,0 +1,175 @@
+/*
+***************************************************************************
+*
+* Author: LetMeFly Tisfy & Teunis van Beelen
+*
+* Copyright (C) 2022 LetMeFly Tisfy & Teunis van Beelen
+*
+* Tisfy@foxmail.com & teuniz@gmail.com
+*
+***************************************************************************
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation version 2 of the License.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*
+***************************************************************************
+*
+* This version of GPL is at https://www.gnu.org/licenses/gpl-3.0.txt
+*
+***************************************************************************
+*/
+
+/*
+ * Output sinks: where EdfReader::read(sink) and read_channels(sink) put
+ * the decoded samples.
+ *
+ * The reader decodes the selection a block of datarecords at a time. For
+ * every block it asks the sink for memory with block(), decodes into it
+ * and hands it back with write(). By default block() gives a buffer that
+ * is reused for every block, so a sink that streams the samples elsewhere
+ * only implements write(); a sink that keeps the samples gives out its own
+ * memory and does nothing in write().
+ *
+ *     EdfNullSink         decodes and forgets, for timing
+ *     EdfEigenSink        an Eigen matrix in memory
+ *     EdfTextSink         text on an ostream, as "cout << mat" prints each block
+ *     EdfMatrixFileSink   a memory-mapped matrix file (edfmatrix.h)
+ *     EdfNpySink          a NumPy .npy file (edfnpy.h)
+ *
+ * Methods return 1 on failure and error() says why.
+ */
+
+#ifndef EDFSINK_H
+#define EDFSINK_H
+
+#include <Eigen/Dense>
+#include <ostream>
+#include <stdarg.h>
+#include <stdio.h>
+
+template<typename Scalar>
+class EdfSink
+{
+public:
+    typedef Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic> stride_type;
+    typedef Eigen::Map<Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>, 0, stride_type> block_type;
+
+    virtual ~EdfSink() {}
+
+    /* the whole output will be rows x cols, called before the first block */
+    virtual int begin(long long rows, long long cols) { (void)rows; (void)cols; return(0); }
+    /* memory for output rows first_row to first_row + rows - 1 */
+    virtual block_type block(long long first_row, long long rows, long long cols);
+    /* those rows have been decoded into the memory block() gave */
+    virtual int write(const block_type& block, long long first_row) = 0;
+    /* all rows have been written */
+    virtual int end() { return(0); }
+
+    const char* error() const { return errmsg; }
+
+protected:
+    int fail(const char* fmt, ...);
+
+    Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> buf;
+
+    char errmsg[512] = "";
+};
+
+template<typename Scalar>
+int EdfSink<Scalar>::fail(const char* fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(errmsg, sizeof(errmsg), fmt, args);
+    va_end(args);
+
+    return(1);
+}
+
+template<typename Scalar>
+typename EdfSink<Scalar>::block_type EdfSink<Scalar>::block(long long first_row, long long rows, long long cols)
+{
+    (void)first_row;
+
+    buf.resize(rows, cols);
+
+    return block_type(buf.data(), rows, cols, stride_type(rows, 1));
+}
+
+template<typename Scalar>
+class EdfNullSink : public EdfSink<Scalar>
+{
+public:
+    int write(const typename EdfSink<Scalar>::block_type& block, long long first_row) override { (void)block; (void)first_row; return(0); }
+};
+
+/* decodes straight into mat, ColMajor or RowMajor */
+template<typename Scalar, int Options = Eigen::ColMajor>
+class EdfEigenSink : public EdfSink<Scalar>
+{
+public:
+    typedef typename EdfSink<Scalar>::block_type block_type;
+    typedef typename EdfSink<Scalar>::stride_type stride_type;
+
+    Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Options> mat;
+
+    int begin(long long rows, long long cols) override
+    {
+        mat.resize(rows, cols);
+        return(0);
+    }
+
+    block_type block(long long first_row, long long rows, long long cols) override
+    {
+        return block_type(mat.data() + first_row * mat.rowStride(), rows, cols, stride_type(mat.colStride(), mat.rowStride()));
+    }
+
+    int write(const block_type& block, long long first_row) override { (void)block; (void)first_row; return(0); }
+};
+
+/* Prints every block as "out << block" does, so the columns are aligned */
+/* within a block only: unless the whole selection is one block, the     */
+/* widths can change from one block to the next.                         */
+template<typename Scalar>
+class EdfTextSink : public EdfSink<Scalar>
+{
+public:
+    explicit EdfTextSink(std::ostream& o) : out(o) {}
+
+    int write(const typename EdfSink<Scalar>::block_type& block, long long first_row) override
+    {
+        if (first_row > 0)
+            out << '\n';
+
+        out << block;
+
+        if (!out)
+        {
+            return this->fail("Error, can not write the samples");
+        }
+
+        return(0);
+    }
+
+    int end() override
+    {
+        out << std::endl;
+        return(0);
+    }
+
+private:
+    std::ostream& out;
+};
+
+#endif
@@ -0,0 +1,297 @@
+/*
+***************************************************************************
+*
+* Author: LetMeFly Tisfy & Teunis van Beelen
+*
+* Copyright (C) 2022 LetMeFly Tisfy & Teunis van Beelen
+*
+* Tisfy@foxmail.com & teuniz@gmail.com
+*
+***************************************************************************
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation version 2 of the License.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*
+***************************************************************************
+*
+* This version of GPL is at https://www.gnu.org/licenses/gpl-3.0.txt
+*
+***************************************************************************
+*/
+
+/*
+ * A minimal io_uring reader on top of the raw system calls (no liburing).
+ *
+ * The submission and completion rings are mapped once; edf_uring_read()
+ * queues a read, edf_uring_submit() hands all queued reads to the kernel and
+ * optionally waits for one to finish, edf_uring_wait() only waits, and
+ * edf_uring_reap() takes finished reads off the completion ring. When the
+ * destination memory was registered with edf_uring_register() the reads use
+ * the registered buffer, which saves the kernel from pinning the pages on
+ * every read.
+ *
+ * Where io_uring is not available edf_uring_init() returns 1 and the caller
+ * reads with pread instead.
+ */
+
+#ifndef EDFURING_H
+#define EDFURING_H
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define EDF_HAVE_IO_URING
+#endif
+#endif
+#endif
+
+#ifdef EDF_HAVE_IO_URING
+
+struct edf_uring
+{
+    int fd = -1,
+        fixed = 0;
+
+    unsigned* sq_head = NULL,
+        * sq_tail = NULL,
+        * sq_mask = NULL,
+        * sq_array = NULL,
+        * cq_head = NULL,
+        * cq_tail = NULL,
+        * cq_mask = NULL;
+
+    unsigned entries = 0,
+        queued = 0;
+
+    struct io_uring_sqe* sqes = NULL;
+    struct io_uring_cqe* cqes = NULL;
+
+    void* sq_ptr = NULL,
+        * cq_ptr = NULL;
+
+    size_t sq_len = 0,
+        cq_len = 0,
+        sqes_len = 0;
+
+    /* the iovecs of reads into unregistered memory, one per submission slot */
+    struct iovec* iov = NULL;
+};
+
+inline void edf_uring_exit(edf_uring* u)
+{
+    if (u->sqes != NULL)
+        munmap(u->sqes, u->sqes_len);
+    if ((u->cq_ptr != NULL) && (u->cq_ptr != u->sq_ptr))
+        munmap(u->cq_ptr, u->cq_len);
+    if (u->sq_ptr != NULL)
+        munmap(u->sq_ptr, u->sq_len);
+    if (u->fd >= 0)
+        close(u->fd);
+
+    delete[] u->iov;
+
+    *u = edf_uring();
+}
+
+/* sets up a ring for at least entries reads in flight, 1 if io_uring is not available */
+inline int edf_uring_init(edf_uring* u, unsigned entries)
+{
+    struct io_uring_params p;
+
+    char* sq;
+    char* cq;
+
+    memset(&p, 0, sizeof(p));
+
+    u->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (u->fd < 0)
+    {
+        u->fd = -1;
+        return(1);
+    }
+
+    u->entries = p.sq_entries;
+    u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if ((p.features & IORING_FEAT_SINGLE_MMAP) && (u->cq_len > u->sq_len))
+        u->sq_len = u->cq_len;
+
+    u->sq_ptr = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ptr == MAP_FAILED)
+    {
+        u->sq_ptr = NULL;
+        edf_uring_exit(u);
+        return(1);
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        u->cq_ptr = u->sq_ptr;
+    }
+    else
+    {
+        u->cq_ptr = mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_ptr == MAP_FAILED)
+        {
+            u->cq_ptr = NULL;
+            edf_uring_exit(u);
+            return(1);
+        }
+    }
+
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = (struct io_uring_sqe*)mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED)
+    {
+        u->sqes = NULL;
+        edf_uring_exit(u);
+        return(1);
+    }
+
+    sq = (char*)u->sq_ptr;
+    cq = (char*)u->cq_ptr;
+
+    u->sq_head = (unsigned*)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned*)(sq + p.sq_off.array);
+    u->cq_head = (unsigned*)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    u->iov = new struct iovec[u->entries];
+
+    return(0);
+}
+
+/* registers the memory all reads go to, 1 if the kernel refuses (e.g. RLIMIT_MEMLOCK) */
+inline int edf_uring_register(edf_uring* u, void* buf, size_t len)
+{
+    struct iovec iov;
+
+    iov.iov_base = buf;
+    iov.iov_len = len;
+
+    if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0)
+        return(1);
+
+    u->fixed = 1;
+
+    return(0);
+}
+
+/* queues a read of len bytes at pos into dst, 1 if the submission ring is full */
+inline int edf_uring_read(edf_uring* u, int fd, char* dst, unsigned len, long long pos, unsigned long long tag)
+{
+    unsigned tail = *u->sq_tail,
+        idx;
+
+    struct io_uring_sqe* sqe;
+
+    if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->entries)
+        return(1);
+
+    idx = tail & *u->sq_mask;
+    sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+
+    sqe->fd = fd;
+    sqe->off = pos;
+    sqe->user_data = tag;
+
+    if (u->fixed)
+    {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->addr = (unsigned long long)dst;
+        sqe->len = len;
+        sqe->buf_index = 0;
+    }
+    else
+    {
+        u->iov[idx].iov_base = dst;
+        u->iov[idx].iov_len = len;
+        sqe->opcode = IORING_OP_READV;
+        sqe->addr = (unsigned long long)&u->iov[idx];
+        sqe->len = 1;
+    }
+
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->queued++;
+
+    return(0);
+}
+
+/* submits the queued reads and waits until at least wait_nr have finished */
+inline int edf_uring_submit(edf_uring* u, unsigned wait_nr)
+{
+    int n;
+
+    do
+    {
+        n = syscall(__NR_io_uring_enter, u->fd, u->queued, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while ((n < 0) && (errno == EINTR));
+
+    if (n < 0)
+        return(1);
+
+    u->queued -= n;
+
+    return(0);
+}
+
+/* waits until at least wait_nr reads have finished, submitting nothing */
+inline int edf_uring_wait(edf_uring* u, unsigned wait_nr)
+{
+    int n;
+
+    do
+    {
+        n = syscall(__NR_io_uring_enter, u->fd, 0, wait_nr, IORING_ENTER_GETEVENTS, NULL, 0);
+    } while ((n < 0) && (errno == EINTR));
+
+    return (n < 0);
+}
+
+/* takes one finished read off the completion ring, 0 if there is none */
+inline int edf_uring_reap(edf_uring* u, unsigned long long* tag, int* res)
+{
+    unsigned head = *u->cq_head;
+
+    struct io_uring_cqe* cqe;
+
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+        return(0);
+
+    cqe = &u->cqes[head & *u->cq_mask];
+    *tag = cqe->user_data;
+    *res = cqe->res;
+
+    __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+
+    return(1);
+}
+
+#endif
+
+#endif